@@ -0,0 +1,252 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A small benchmark runner in the style of Google Benchmark, which is not a dependency of this project.
+// A benchmark does its setup, then loops over the BenchState it is given, which times just the loop. The runner
+// grows the number of iterations until the loop takes at least --min_time seconds, repeats the run a few times and
+// keeps the fastest (the least disturbed by everything else on the machine). Results print as a table and, with --json, in Google Benchmark's json format.
+// --baseline compares against such a file and flags anything more than --threshold slower.
+
+// keeps the compiler from dropping a result nobody reads
+template <typename T>
+inline void doNotOptimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// for (auto i : state) runs the body state.iterations() times, i counting up from 0, and times only that
+class BenchState
+{
+public:
+    explicit BenchState(int64_t _iterations) : count(_iterations) {}
+
+    struct Iterator
+    {
+        BenchState *state;
+        int64_t i;
+        int64_t operator*() const { return i; }
+        void operator++() { i++; }
+        bool operator!=(const Iterator &end)
+        {
+            if (i < end.i)
+            {
+                return true;
+            }
+            state->stopped = std::chrono::steady_clock::now();
+            return false;
+        }
+    };
+    Iterator begin()
+    {
+        started = std::chrono::steady_clock::now();
+        return Iterator{this, 0};
+    }
+    Iterator end() { return Iterator{this, count}; }
+
+    int64_t iterations() const { return count; }
+    double seconds() const { return std::chrono::duration<double>(stopped - started).count(); }
+
+private:
+    int64_t count;
+    std::chrono::steady_clock::time_point started, stopped;
+};
+
+struct BenchResult
+{
+    std::string name;
+    int64_t iterations;
+    double ns_per_iteration;
+};
+
+class BenchRegistry
+{
+public:
+    static BenchRegistry &instance()
+    {
+        static BenchRegistry registry;
+        return registry;
+    }
+
+    void add(const std::string &name, std::function<void(BenchState &)> run) { benchmarks.push_back({name, run}); }
+
+    int main(int argc, char **argv)
+    {
+        std::string filter, json_path, baseline_path;
+        double min_time = 0.2, threshold = 0.25;
+        int repetitions = 3;
+        for (int k = 1; k < argc; k++)
+        {
+            std::string arg = argv[k];
+            auto value = arg.substr(arg.find('=') + 1);
+            if (arg.rfind("--filter=", 0) == 0)
+                filter = value;
+            else if (arg.rfind("--json=", 0) == 0)
+                json_path = value;
+            else if (arg.rfind("--baseline=", 0) == 0)
+                baseline_path = value;
+            else if (arg.rfind("--min_time=", 0) == 0)
+                min_time = std::atof(value.c_str());
+            else if (arg.rfind("--repetitions=", 0) == 0)
+                repetitions = std::max(1, std::atoi(value.c_str()));
+            else if (arg.rfind("--threshold=", 0) == 0)
+                threshold = std::atof(value.c_str());
+            else
+            {
+                std::fprintf(stderr, "usage: %s [--filter=substring] [--json=out.json] [--baseline=old.json] "
+                                     "[--threshold=0.25] [--min_time=0.2] [--repetitions=3]\n",
+                             argv[0]);
+                return 2;
+            }
+        }
+
+        std::map<std::string, double> baseline;
+        if (!baseline_path.empty() && !readJson(baseline_path, baseline))
+        {
+            std::fprintf(stderr, "could not read baseline %s\n", baseline_path.c_str());
+            return 2;
+        }
+
+        std::vector<BenchResult> results;
+        int regressions = 0;
+        std::printf("%-44s %14s %12s", "benchmark", "ns/iteration", "iterations");
+        std::printf(baseline.empty() ? "\n" : " %14s %8s\n", "baseline ns", "ratio");
+        for (const auto &bench : benchmarks)
+        {
+            if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+            {
+                continue;
+            }
+            auto result = measure(bench, min_time, repetitions);
+            results.push_back(result);
+            std::printf("%-44s %14.2f %12lld", result.name.c_str(), result.ns_per_iteration,
+                        static_cast<long long>(result.iterations));
+            auto old = baseline.find(result.name);
+            if (old != baseline.end() && old->second > 0)
+            {
+                auto ratio = result.ns_per_iteration / old->second;
+                bool slower = ratio > 1 + threshold;
+                regressions += slower;
+                std::printf(" %14.2f %7.2fx%s", old->second, ratio, slower ? "  REGRESSION" : "");
+            }
+            std::printf("\n");
+            std::fflush(stdout);
+        }
+        if (!json_path.empty() && !writeJson(json_path, results))
+        {
+            std::fprintf(stderr, "could not write %s\n", json_path.c_str());
+            return 2;
+        }
+        if (regressions > 0)
+        {
+            std::printf("%d benchmarks more than %.0f%% slower than the baseline\n", regressions, threshold * 100);
+            return 1;
+        }
+        return 0;
+    }
+
+private:
+    struct Bench
+    {
+        std::string name;
+        std::function<void(BenchState &)> run;
+    };
+    std::vector<Bench> benchmarks;
+
+    static BenchResult measure(const Bench &bench, double min_time, int repetitions)
+    {
+        int64_t iterations = 1;
+        double seconds = 0;
+        // grow the count until one run is long enough to time, aiming a little past min_time
+        while (true)
+        {
+            seconds = time(bench, iterations);
+            if (seconds >= min_time || iterations >= (int64_t(1) << 40))
+            {
+                break;
+            }
+            auto scale = seconds > 0 ? 1.4 * min_time / seconds : 100;
+            iterations = static_cast<int64_t>(iterations * std::min(100.0, std::max(2.0, scale)));
+        }
+        auto best = seconds;
+        for (int r = 1; r < repetitions; r++)
+        {
+            best = std::min(best, time(bench, iterations));
+        }
+        return BenchResult{bench.name, iterations, best * 1e9 / iterations};
+    }
+    static double time(const Bench &bench, int64_t iterations)
+    {
+        BenchState state(iterations);
+        bench.run(state);
+        return state.seconds();
+    }
+
+    static bool writeJson(const std::string &path, const std::vector<BenchResult> &results)
+    {
+        std::ofstream out(path);
+        char date[64];
+        auto now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+        out << "{\n  \"context\": {\n    \"date\": \"" << date << "\",\n    \"num_cpus\": "
+            << std::thread::hardware_concurrency() << ",\n    \"library_build_type\": \"release\"\n  },\n"
+            << "  \"benchmarks\": [\n";
+        for (size_t k = 0; k < results.size(); k++)
+        {
+            out << "    {\n      \"name\": \"" << results[k].name << "\",\n      \"run_type\": \"iteration\",\n"
+                << "      \"iterations\": " << results[k].iterations << ",\n      \"real_time\": "
+                << results[k].ns_per_iteration << ",\n      \"cpu_time\": " << results[k].ns_per_iteration
+                << ",\n      \"time_unit\": \"ns\"\n    }" << (k + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return static_cast<bool>(out);
+    }
+    // name and real_time of every benchmark in a json file, ours or Google Benchmark's. real_time is in ns, the
+    // default unit of both
+    static bool readJson(const std::string &path, std::map<std::string, double> &times)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            return false;
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+        auto json = text.str();
+        size_t at = 0;
+        while ((at = json.find("\"name\":", at)) != std::string::npos)
+        {
+            auto open = json.find('"', at + 7);
+            auto close = json.find('"', open + 1);
+            auto time_at = json.find("\"real_time\":", close);
+            if (open == std::string::npos || close == std::string::npos || time_at == std::string::npos)
+            {
+                break;
+            }
+            times[json.substr(open + 1, close - open - 1)] = std::atof(json.c_str() + time_at + 12);
+            at = close;
+        }
+        return true;
+    }
+};
+
+// registers a benchmark called name, the body gets BenchState &state, e.g.
+//     BENCH(sphere_hit) { Sphere sphere(...); for (auto i : state) sphere.hit(...); }
+#define BENCH_CONCAT(a, b) a##b
+#define BENCH_NAME(line) BENCH_CONCAT(bench_registered_, line)
+#define BENCH(name)                                                                        \
+    static void name(BenchState &state);                                                   \
+    static bool BENCH_NAME(__LINE__) = (BenchRegistry::instance().add(#name, name), true); \
+    static void name(BenchState &state)
@@ -0,0 +1,149 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "fast_math.h"
+
+// Accuracy and speed of fast_math.h against libm. Every approximation is swept over its domain (a dense grid plus
+// random points, the edges included) and its largest error is checked against the bound fast_math.h promises. The
+// exit status is 1 if any bound is broken. Then each is timed against libm over an array, the way a loop would call it.
+// This checks the functions themselves in any build. What they do to the images is measured with SceneBench:
+//
+//     build/SceneBench --make-references --references=/tmp/libm --reference-spp=16    (default build)
+//     fast/SceneBench --references=/tmp/libm --spp=16                                 (-DRAYCASTER_FAST_MATH=ON)
+//
+// where the rmse column is then the difference between the two builds' renders of the same samples.
+
+static int failures = 0;
+
+static void check(const char *name, double error, double bound, const char *unit)
+{
+    bool ok = error <= bound;
+    failures += !ok;
+    std::printf("%-10s max error %10.3g %-9s bound %8.1g  %s\n", name, error, unit, bound, ok ? "ok" : "FAILED");
+}
+
+// n points from low to high, then as many random ones
+static std::vector<double> sweep(double low, double high, int n)
+{
+    std::vector<double> xs;
+    for (int k = 0; k <= n; k++)
+    {
+        xs.push_back(low + (high - low) * k / n);
+    }
+    for (int k = 0; k < n; k++)
+    {
+        xs.push_back(randomDouble(low, high));
+    }
+    return xs;
+}
+
+// ns per call over an array of inputs
+static double timeCalls(const std::vector<double> &xs, const std::function<void(const double *, double *, size_t)> &run)
+{
+    std::vector<double> out(xs.size());
+    double best = 1e9;
+    for (int rep = 0; rep < 5; rep++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run(xs.data(), out.data(), xs.size());
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, seconds);
+        doNotOptimize(out);
+    }
+    return 1e9 * best / xs.size();
+}
+
+// the loops are spelled out so each is compiled (and vectorized, where it can be) for its own function
+#define TIME_LOOP(expression) [](const double *x, double *y, size_t n) { for (size_t k = 0; k < n; k++) y[k] = (expression); }
+
+int main()
+{
+    srand(11);
+
+    double error = 0;
+    for (auto angle : sweep(-pi, pi, 200000))
+    {
+        for (double radius : {1e-3, 1.0, 1e3})
+        {
+            auto y = radius * sin(angle), x = radius * cos(angle);
+            error = fmax(error, fabs(fastAtan2(y, x) - atan2(y, x)));
+        }
+    }
+    for (double y : {0.0, 1.0, -1.0})
+    {
+        for (double x : {0.0, 1.0, -1.0})
+        {
+            // the axes and the origin, -pi and pi are the same angle
+            auto d = fabs(fastAtan2(y, x) - atan2(y, x));
+            error = fmax(error, fmin(d, fabs(d - 2 * pi)));
+        }
+    }
+    check("atan2", error, 4e-8, "radians");
+
+    error = 0;
+    for (auto x : sweep(-1, 1, 1000000))
+    {
+        error = fmax(error, fabs(fastAcos(x) - acos(x)));
+    }
+    check("acos", error, 4e-8, "radians");
+
+    error = 0;
+    auto logs = sweep(0, 1, 1000000);
+    for (int k = 0; k < 1000000; k++)
+    {
+        // across the whole exponent range too
+        logs.push_back(randomDouble(1, 2) * pow(2.0, randomInt(-1020, 1020)));
+    }
+    for (auto x : logs)
+    {
+        if (x > 0)
+        {
+            error = fmax(error, fabs(fastLog(x) - log(x)));
+        }
+    }
+    bool log_edges = fastLog(0) == -infinity && std::isnan(fastLog(-1));
+    check("log", log_edges ? error : infinity, 1e-12, "absolute");
+
+    error = 0;
+    for (auto x : sweep(-708, 709, 1000000))
+    {
+        error = fmax(error, fabs(fastExp(x) - exp(x)) / exp(x));
+    }
+    bool exp_edges = fastExp(-infinity) == 0 && fastExp(-800) == 0 && fastExp(800) == infinity && fastExp(0) == 1;
+    check("exp", exp_edges ? error : infinity, 1e-9, "relative");
+
+    error = 0;
+    for (auto x : sweep(0, 1, 100000))
+    {
+        for (double y : {0.5, 1.0, 5.0, 64.0, 128.0})
+        {
+            auto exact = pow(x, y);
+            // far below anything a weight could notice, only the relative error of the rest matters
+            if (exact > 1e-200)
+            {
+                error = fmax(error, fabs(fastPow(x, y) - exact) / exact);
+            }
+        }
+    }
+    check("pow", fastPow(0, 64) == 0 ? error : infinity, 1e-9, "relative");
+
+    std::printf("\n%-10s %12s %12s %8s\n", "function", "libm ns", "fast ns", "speedup");
+    auto row = [](const char *name, double libm, double fast)
+    { std::printf("%-10s %12.2f %12.2f %8.2f\n", name, libm, fast, libm / fast); };
+    auto unit = sweep(-1, 1, 1 << 19);
+    auto positive = sweep(1e-6, 1, 1 << 19);
+    auto negative = sweep(-20, 0, 1 << 19);
+    row("atan2", timeCalls(unit, TIME_LOOP(atan2(x[k], 0.5 - x[k]))), timeCalls(unit, TIME_LOOP(fastAtan2(x[k], 0.5 - x[k]))));
+    row("acos", timeCalls(unit, TIME_LOOP(acos(x[k]))), timeCalls(unit, TIME_LOOP(fastAcos(x[k]))));
+    row("log", timeCalls(positive, TIME_LOOP(log(x[k]))), timeCalls(positive, TIME_LOOP(fastLog(x[k]))));
+    row("exp", timeCalls(negative, TIME_LOOP(exp(x[k]))), timeCalls(negative, TIME_LOOP(fastExp(x[k]))));
+    row("pow", timeCalls(positive, TIME_LOOP(pow(x[k], 64.0))), timeCalls(positive, TIME_LOOP(fastPow(x[k], 64.0))));
+
+    std::printf("\n%s\n", failures == 0 ? "all within bounds" : "some approximations are out of bounds");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+#include <memory>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "aabb.h"
+#include "bvh_node.h"
+#include "hittable_array.h"
+#include "material.h"
+#include "perlin.h"
+#include "quad.h"
+#include "ray.h"
+#include "sampler.h"
+#include "sphere.h"
+#include "texture.h"
+#include "vec3.h"
+
+// Microbenchmarks of the renderer's hot paths: intersection, traversal, texturing and scattering.
+// Setup happens before the timed loop. Every kernel cycles through a fixed set of rays (or points), so branch
+// prediction cannot learn a single case, and everything random is seeded so runs are comparable. Run from the build directory so ImageTexture finds ../images.
+
+static const int ray_count = 1024; // a power of two, rays are picked with i & (ray_count - 1)
+
+// rays from outside a box of half size extent towards random points inside it, so most of them hit something
+static std::vector<Ray> makeRays(double extent, bool timed = false)
+{
+    srand(1234);
+    std::vector<Ray> rays;
+    for (int k = 0; k < ray_count; k++)
+    {
+        Point3 origin = vec3::random(-1, 1) * (3 * extent);
+        Point3 target = vec3::random(-1, 1) * extent;
+        rays.push_back(Ray(origin, target - origin, timed ? randomDouble() : 0));
+    }
+    return rays;
+}
+
+static std::shared_ptr<Material> gray() { return std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)); }
+
+// count spheres spread over a cube, sized so a ray passes through about the same number of them at any count
+static HittableArray makeSpheres(int count)
+{
+    srand(99);
+    HittableArray world;
+    auto material = gray();
+    auto radius = 50.0 / cbrt(count);
+    for (int k = 0; k < count; k++)
+    {
+        world.add(std::make_shared<Sphere>(vec3::random(-50, 50), radius * randomDouble(0.3, 1.0), material));
+    }
+    return world;
+}
+
+BENCH(aabb_hit)
+{
+    AABB box(Point3(-1, -1, -1), Point3(1, 1, 1));
+    auto rays = makeRays(2);
+    int hits = 0;
+    for (auto i : state)
+    {
+        hits += box.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity));
+    }
+    doNotOptimize(hits);
+}
+
+BENCH(sphere_hit_static)
+{
+    Sphere sphere(Point3(0, 0, 0), 1, gray());
+    auto rays = makeRays(1.5);
+    hit_info info;
+    int hits = 0;
+    for (auto i : state)
+    {
+        hits += sphere.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity), info);
+    }
+    doNotOptimize(hits);
+    doNotOptimize(info);
+}
+
+BENCH(sphere_hit_moving)
+{
+    Sphere sphere(Point3(0, -0.5, 0), Point3(0, 0.5, 0), 1, gray());
+    auto rays = makeRays(1.5, true);
+    hit_info info;
+    int hits = 0;
+    for (auto i : state)
+    {
+        hits += sphere.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity), info);
+    }
+    doNotOptimize(hits);
+    doNotOptimize(info);
+}
+
+BENCH(quad_hit)
+{
+    Quad quad(Point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), gray());
+    auto rays = makeRays(1.5);
+    hit_info info;
+    int hits = 0;
+    for (auto i : state)
+    {
+        hits += quad.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity), info);
+    }
+    doNotOptimize(hits);
+    doNotOptimize(info);
+}
+
+// the same scenes through a flat list and through a bvh, and the cost of building the bvh
+static bool sized_benchmarks = []()
+{
+    for (int count : {16, 256, 4096})
+    {
+        auto suffix = "/" + std::to_string(count);
+        if (count <= 256)
+        {
+            // a flat list of 4096 takes a while per ray and says nothing new
+            BenchRegistry::instance().add("hittable_array_hit" + suffix, [count](BenchState &state)
+                                          {
+                auto world = makeSpheres(count);
+                auto rays = makeRays(50);
+                hit_info info;
+                int hits = 0;
+                for (auto i : state)
+                    hits += world.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity), info);
+                doNotOptimize(hits); });
+        }
+        BenchRegistry::instance().add("bvh_hit" + suffix, [count](BenchState &state)
+                                      {
+            auto world = makeSpheres(count);
+            BVHNode bvh(world);
+            auto rays = makeRays(50);
+            hit_info info;
+            int hits = 0;
+            for (auto i : state)
+                hits += bvh.hit(rays[i & (ray_count - 1)], Interval(0.001, infinity), info);
+            doNotOptimize(hits); });
+        BenchRegistry::instance().add("bvh_build" + suffix, [count](BenchState &state)
+                                      {
+            auto world = makeSpheres(count);
+            for (auto i : state)
+            {
+                (void)i;
+                BVHNode bvh(world);
+                doNotOptimize(bvh);
+            } });
+    }
+    return true;
+}();
+
+BENCH(perlin_turbulence)
+{
+    Perlin noise;
+    srand(7);
+    std::vector<Point3> points;
+    for (int k = 0; k < ray_count; k++)
+    {
+        points.push_back(vec3::random(-10, 10));
+    }
+    double sum = 0;
+    for (auto i : state)
+    {
+        sum += noise.turbulence(points[i & (ray_count - 1)]);
+    }
+    doNotOptimize(sum);
+}
+
+BENCH(image_texture_value)
+{
+    ImageTexture texture("earthmap.jpg");
+    srand(8);
+    std::vector<double> uvs;
+    for (int k = 0; k < 2 * ray_count; k++)
+    {
+        uvs.push_back(randomDouble());
+    }
+    Color sum(0, 0, 0);
+    for (auto i : state)
+    {
+        auto k = 2 * (i & (ray_count - 1));
+        sum += texture.value(uvs[k], uvs[k + 1], Point3(0, 0, 0));
+    }
+    doNotOptimize(sum);
+}
+
+// one scatter off a sphere per iteration, with the sampler moved on to a fresh sample each time like the camera does
+static void scatterBench(const std::shared_ptr<Material> &material, BenchState &state)
+{
+    Sphere sphere(Point3(0, 0, 0), 1, material);
+    auto rays = makeRays(0.5);
+    std::vector<hit_info> hits(ray_count);
+    for (int k = 0; k < ray_count; k++)
+    {
+        sphere.hit(rays[k], Interval(0.001, infinity), hits[k]);
+    }
+    SobolSampler sampler;
+    Color attenuation;
+    Ray scattered;
+    int scatters = 0;
+    for (auto i : state)
+    {
+        auto k = i & (ray_count - 1);
+        sampler.startPixelSample(0, 0, static_cast<int>(i));
+        sampler.startBounce(0);
+        scatters += material->scatter(rays[k], hits[k], attenuation, scattered, sampler);
+    }
+    doNotOptimize(scatters);
+    doNotOptimize(scattered);
+}
+
+BENCH(scatter_lambertian) { scatterBench(gray(), state); }
+BENCH(scatter_metal) { scatterBench(std::make_shared<Metal>(Color(0.8, 0.8, 0.8), 0.2), state); }
+BENCH(scatter_dielectric) { scatterBench(std::make_shared<Dielectric>(1.5), state); }
+BENCH(scatter_diffuse_light) { scatterBench(std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(4, 4, 4))), state); }
+BENCH(scatter_isotropic) { scatterBench(std::make_shared<Isotropic>(Color(0.7, 0.7, 0.7)), state); }
+
+int main(int argc, char **argv)
+{
+    return BenchRegistry::instance().main(argc, argv);
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "render_server.h"
+#include "scenes.h"
+
+// End to end benchmark: renders every built in scene at fixed settings and a list of sample counts, recording wall
+// time, rays per second and peak memory, and the error against a stored high sample count reference of the scene.
+// Error over time at increasing sample counts is a time to quality curve, which is what a sampling or denoising
+// change has to improve to be worth it (a faster render that converges slower is no win).
+// Each scene runs in a forked process of its own, so its peak RSS is its own.
+//
+//     SceneBench [--scenes=cornell,book2] [--width=64] [--spp=1,4,16,64] [--set=key=value ...] [--json=out.json]
+//                [--references=<source dir>/bench/references] [--make-references [--reference-spp=1024]]
+//                [--max-rmse=0.25]
+//
+// --set takes the render server's job settings (denoise=1, sampler=halton, lights=2, ...), applied to every render.
+// --max-rmse fails a scene, and so the run, when any of its renders is further than that from its reference or it has
+// no reference. That is how ctest runs it, as a check that the images still come out right.
+// Run from the build directory, as textures are found through ../images.
+
+struct Options
+{
+    std::vector<std::string> scenes;
+    int width = 64;
+    std::vector<int> spps = {1, 4, 16, 64};
+    std::vector<std::string> settings;
+    std::string json_path;
+    std::string references = RT_SOURCE_DIR "/bench/references";
+    bool make_references = false;
+    int reference_spp = 1024;
+    double max_rmse = -1; // off
+};
+
+static std::vector<std::string> split(const std::string &text)
+{
+    std::vector<std::string> parts;
+    std::stringstream in(text);
+    std::string part;
+    while (std::getline(in, part, ','))
+    {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+// portable float map, linear rgb floats with the bottom row first
+static bool writePFM(const std::string &path, int width, int height, const std::vector<Color> &pixels)
+{
+    std::ofstream out(path, std::ios::binary);
+    out << "PF\n"
+        << width << " " << height << "\n-1.0\n";
+    for (int j = height - 1; j >= 0; j--)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            const auto &c = pixels[static_cast<size_t>(j) * width + i];
+            float rgb[3] = {float(c.x()), float(c.y()), float(c.z())};
+            out.write(reinterpret_cast<const char *>(rgb), sizeof(rgb));
+        }
+    }
+    return static_cast<bool>(out);
+}
+static bool readPFM(const std::string &path, int width, int height, std::vector<Color> &pixels)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string magic;
+    int w, h;
+    double scale;
+    if (!(in >> magic >> w >> h >> scale) || magic != "PF" || w != width || h != height || scale >= 0)
+    {
+        return false;
+    }
+    in.get();
+    pixels.assign(static_cast<size_t>(width) * height, Color(0, 0, 0));
+    for (int j = height - 1; j >= 0; j--)
+    {
+        for (int i = 0; i < width; i++)
+        {
+            float rgb[3];
+            if (!in.read(reinterpret_cast<char *>(rgb), sizeof(rgb)))
+            {
+                return false;
+            }
+            pixels[static_cast<size_t>(j) * width + i] = Color(rgb[0], rgb[1], rgb[2]);
+        }
+    }
+    return true;
+}
+
+// root mean squared error, and mean squared error relative to the reference's brightness (so dark scenes count)
+static void imageError(const std::vector<Color> &image, const std::vector<Color> &reference, double &rmse, double &rel_mse)
+{
+    double squared = 0, relative = 0;
+    for (size_t k = 0; k < image.size(); k++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            auto d = image[k][c] - reference[k][c];
+            squared += d * d;
+            relative += d * d / (reference[k][c] * reference[k][c] + 1e-2);
+        }
+    }
+    rmse = sqrt(squared / (3 * image.size()));
+    rel_mse = relative / (3 * image.size());
+}
+
+static Camera benchCamera(const Scene &scene, const Options &options, int spp)
+{
+    Camera camera = scene.camera;
+    camera.img_width = options.width;
+    camera.samples_per_pixel = spp;
+    // the results table goes to stdout, progress would bury it
+    camera.progress = false;
+    for (const auto &setting : options.settings)
+    {
+        RenderServer::applySetting(camera, setting);
+    }
+    return camera;
+}
+
+// everything for one scene, in the forked process. json records go to out. false if a render is off by more than
+// --max-rmse
+static bool benchScene(const SceneEntry &entry, const Options &options, std::ostream &out)
+{
+    auto build_start = std::chrono::steady_clock::now();
+    Scene scene = entry.build();
+    auto build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - build_start).count();
+    auto reference_path = options.references + "/" + entry.name + "_" + std::to_string(options.width) + ".pfm";
+
+    if (options.make_references)
+    {
+        // references are plain renders, whatever --set says
+        Camera camera = scene.camera;
+        camera.img_width = options.width;
+        camera.samples_per_pixel = options.reference_spp;
+        camera.progress = false;
+        std::ostringstream image;
+        camera.render(*scene.world, image);
+        auto &buffers = camera.buffers;
+        bool written = writePFM(reference_path, buffers.width, buffers.height, buffers.color);
+        std::printf("%-14s reference %s%s\n", entry.name, reference_path.c_str(), written ? "" : " could not be written");
+        return true;
+    }
+
+    std::vector<Color> reference;
+    bool have_reference = false;
+    bool within = true;
+    for (size_t s = 0; s < options.spps.size(); s++)
+    {
+        auto camera = benchCamera(scene, options, options.spps[s]);
+        std::ostringstream image;
+        auto start = std::chrono::steady_clock::now();
+        camera.render(*scene.world, image);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto &buffers = camera.buffers;
+        if (s == 0)
+        {
+            have_reference = readPFM(reference_path, buffers.width, buffers.height, reference);
+        }
+        double rmse = -1, rel_mse = -1;
+        if (have_reference)
+        {
+            imageError(buffers.color, reference, rmse, rel_mse);
+        }
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        auto peak_mb = usage.ru_maxrss / 1024.0;
+        auto rays_per_second = camera.rays_traced / seconds;
+        std::printf("%-14s %6d %10.3f %12.0f %9.1f %12.6f %12.6f\n", entry.name, options.spps[s], seconds,
+                    rays_per_second, peak_mb, rmse, rel_mse);
+        std::fflush(stdout);
+        out << "    {\"scene\": \"" << entry.name << "\", \"width\": " << buffers.width << ", \"height\": "
+            << buffers.height << ", \"spp\": " << options.spps[s] << ", \"build_seconds\": " << build_seconds
+            << ", \"seconds\": " << seconds << ", \"rays\": " << camera.rays_traced << ", \"rays_per_second\": "
+            << rays_per_second << ", \"peak_rss_mb\": " << peak_mb << ", \"rmse\": " << rmse
+            << ", \"rel_mse\": " << rel_mse << "}\n";
+        if (options.max_rmse >= 0 && have_reference && rmse > options.max_rmse)
+        {
+            std::printf("%-14s rmse %g at %d spp is above --max-rmse=%g\n", entry.name, rmse, options.spps[s], options.max_rmse);
+            within = false;
+        }
+    }
+    if (!have_reference)
+    {
+        std::printf("%-14s no reference at %s, run with --make-references\n", entry.name, reference_path.c_str());
+    }
+    return within && (have_reference || options.max_rmse < 0);
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    for (int k = 1; k < argc; k++)
+    {
+        std::string arg = argv[k];
+        auto value = arg.substr(arg.find('=') + 1);
+        if (arg.rfind("--scenes=", 0) == 0)
+            options.scenes = split(value);
+        else if (arg.rfind("--width=", 0) == 0)
+            options.width = std::max(1, std::atoi(value.c_str()));
+        else if (arg.rfind("--spp=", 0) == 0)
+        {
+            options.spps.clear();
+            for (const auto &spp : split(value))
+                options.spps.push_back(std::max(1, std::atoi(spp.c_str())));
+        }
+        else if (arg.rfind("--set=", 0) == 0)
+            options.settings.push_back(value);
+        else if (arg.rfind("--json=", 0) == 0)
+            options.json_path = value;
+        else if (arg.rfind("--references=", 0) == 0)
+            options.references = value;
+        else if (arg == "--make-references")
+            options.make_references = true;
+        else if (arg.rfind("--reference-spp=", 0) == 0)
+            options.reference_spp = std::max(1, std::atoi(value.c_str()));
+        else if (arg.rfind("--max-rmse=", 0) == 0)
+            options.max_rmse = std::atof(value.c_str());
+        else
+        {
+            std::fprintf(stderr, "unknown option %s, see the top of bench/scene_bench.cpp\n", arg.c_str());
+            return 2;
+        }
+    }
+    // settings are checked once up front rather than ignored in every render
+    for (const auto &setting : options.settings)
+    {
+        Camera camera;
+        if (!RenderServer::applySetting(camera, setting))
+        {
+            std::fprintf(stderr, "bad setting %s\n", setting.c_str());
+            return 2;
+        }
+    }
+
+    if (!options.make_references)
+    {
+        std::printf("%-14s %6s %10s %12s %9s %12s %12s\n", "scene", "spp", "seconds", "rays/s", "peak MB", "rmse", "relMSE");
+    }
+    std::string records;
+    int failures = 0;
+    for (const auto &entry : builtinScenes())
+    {
+        bool wanted = options.scenes.empty();
+        for (const auto &name : options.scenes)
+        {
+            wanted = wanted || name == entry.name;
+        }
+        if (!wanted)
+        {
+            continue;
+        }
+        int fds[2];
+        if (pipe(fds) != 0)
+        {
+            return 1;
+        }
+        std::fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(fds[0]);
+            std::ostringstream out;
+            bool within = benchScene(entry, options, out);
+            auto text = out.str();
+            auto written = write(fds[1], text.data(), text.size());
+            std::fflush(stdout);
+            _exit(within && written == static_cast<ssize_t>(text.size()) ? 0 : 1);
+        }
+        close(fds[1]);
+        char buffer[4096];
+        ssize_t got;
+        while ((got = read(fds[0], buffer, sizeof(buffer))) > 0)
+        {
+            records.append(buffer, static_cast<size_t>(got));
+        }
+        close(fds[0]);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            std::printf("%-14s failed\n", entry.name);
+            failures++;
+        }
+    }
+
+    if (!options.json_path.empty())
+    {
+        // one record per line, joined into an array
+        std::ofstream out(options.json_path);
+        out << "{\n  \"width\": " << options.width << ",\n  \"results\": [\n";
+        std::stringstream lines(records);
+        std::string line;
+        bool first = true;
+        while (std::getline(lines, line))
+        {
+            out << (first ? "" : ",\n") << line;
+            first = false;
+        }
+        out << "\n  ]\n}\n";
+    }
+    return failures > 0 ? 1 : 0;
+}
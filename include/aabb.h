@@ -2,6 +2,7 @@
 #include "interval.h"
 #include "vec3.h"
 #include "ray.h"
+#include "stats.h"
 // Axis aligned bounding rectangular parallelopiped
 class AABB
 {
@@ -42,8 +43,15 @@ public:
         return x;
     }
 
+    double surfaceArea() const
+    {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx * dy + dy * dz + dz * dx);
+    }
+
     bool hit(const Ray &r, Interval r_t) const
     {
+        RT_STAT(STAT_AABB_TESTS);
         for (int i = 0; i < 3; i++)
         {
             auto b_i = 1 / r.direction()[i];
@@ -75,6 +83,14 @@ public:
     }
 };
 
+// box at time t of something bounded by b0 at time 0 and b1 at time 1
+inline AABB lerpBox(const AABB &b0, const AABB &b1, double t)
+{
+    auto lerp = [t](const Interval &i0, const Interval &i1)
+    { return Interval(i0.min + t * (i1.min - i0.min), i0.max + t * (i1.max - i0.max)); };
+    return AABB(lerp(b0.x, b1.x), lerp(b0.y, b1.y), lerp(b0.z, b1.z));
+}
+
 AABB operator+(AABB bbox, const vec3& offset)
 {
     return AABB(bbox.x + offset.x(),bbox.y + offset.y(), bbox.z + offset.z());
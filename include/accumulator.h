@@ -0,0 +1,158 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "render_buffers.h"
+
+// Running sums of a progressive render, and the checkpoint file they are saved to.
+// Every pass adds its pixel means, weighted by its sample count, into float sums (half the size of doubles and plenty
+// for an image), along with the sum of squared sample luminances so the variance buffer survives a resume as well.
+// The file is a small header followed by both arrays as they are in memory. It is written next to the target and
+// renamed over it, so a render killed while saving still leaves the previous checkpoint intact. The header carries a
+// fingerprint of what else makes the image (the scene, sampler, depth and crop, see Camera::checkpointSettings), a
+// checkpoint is only resumed by a render with the same one.
+
+const char checkpoint_magic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '\0', '\0'};
+const uint32_t checkpoint_version = 2;
+
+// 64 bit FNV-1a of a description of the render settings
+inline uint64_t checkpointFingerprint(const std::string &settings)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : settings)
+    {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    uint32_t seed;    // the sampler's, resumed passes have to continue the same sample sequences
+    uint32_t samples; // per pixel, every pixel has the same count
+    uint32_t passes;  // passes so far, what per pass random state (rand, caustic radius) is derived from
+    uint64_t fingerprint;
+};
+
+class Accumulator
+{
+public:
+    int width = 0;
+    int height = 0;
+    uint32_t seed = 0;
+    uint32_t samples = 0;
+    uint32_t passes = 0;
+    uint64_t fingerprint = 0;
+    std::vector<float> color;   // sum of the samples, 3 per pixel
+    std::vector<float> lum_sqr; // sum of the samples' squared luminance
+
+    void reset(int _width, int _height, uint32_t _seed, uint64_t _fingerprint)
+    {
+        width = _width;
+        height = _height;
+        seed = _seed;
+        fingerprint = _fingerprint;
+        samples = 0;
+        passes = 0;
+        color.assign(static_cast<size_t>(width) * height * 3, 0);
+        lum_sqr.assign(static_cast<size_t>(width) * height, 0);
+    }
+
+    // adds a pass of spp samples per pixel, buffers holding its means and the variances of those means
+    void add(const RenderBuffers &buffers, int spp)
+    {
+        for (size_t k = 0; k < lum_sqr.size(); k++)
+        {
+            const auto &c = buffers.color[k];
+            color[3 * k] += static_cast<float>(spp * c.x());
+            color[3 * k + 1] += static_cast<float>(spp * c.y());
+            color[3 * k + 2] += static_cast<float>(spp * c.z());
+            // undoes the variance of the mean, sum of squares = n ((n - 1) variance + mean^2)
+            auto mean = luminance(c);
+            lum_sqr[k] += static_cast<float>(spp * ((spp - 1) * buffers.variance[k] + mean * mean));
+        }
+        samples += spp;
+        passes++;
+    }
+
+    // means and variances of all samples so far into buffers, the other buffers are left alone
+    void resolve(RenderBuffers &buffers) const
+    {
+        if (samples == 0)
+        {
+            return;
+        }
+        double n = samples;
+        for (size_t k = 0; k < lum_sqr.size(); k++)
+        {
+            buffers.color[k] = Color(color[3 * k], color[3 * k + 1], color[3 * k + 2]) / n;
+            auto mean = luminance(buffers.color[k]);
+            buffers.variance[k] = samples > 1 ? fmax(0.0, lum_sqr[k] / n - mean * mean) / (n - 1) : 0;
+        }
+    }
+
+    bool save(const std::string &path) const
+    {
+        CheckpointHeader header;
+        std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+        header.version = checkpoint_version;
+        header.width = width;
+        header.height = height;
+        header.seed = seed;
+        header.samples = samples;
+        header.passes = passes;
+        header.fingerprint = fingerprint;
+
+        auto temp = path + ".tmp";
+        {
+            std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(color.data()), color.size() * sizeof(float));
+            out.write(reinterpret_cast<const char *>(lum_sqr.data()), lum_sqr.size() * sizeof(float));
+            if (!out.flush())
+            {
+                return false;
+            }
+        }
+        return std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+
+    // false, leaving the accumulator as it was, when path holds no checkpoint or one for another image size or
+    // fingerprint
+    bool load(const std::string &path, int _width, int _height, uint64_t _fingerprint)
+    {
+        std::ifstream in(path, std::ios::binary);
+        CheckpointHeader header;
+        if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0 ||
+            header.version != checkpoint_version || header.width != _width || header.height != _height ||
+            header.fingerprint != _fingerprint)
+        {
+            return false;
+        }
+        size_t n = static_cast<size_t>(_width) * _height;
+        std::vector<float> _color(n * 3), _lum_sqr(n);
+        if (!in.read(reinterpret_cast<char *>(_color.data()), _color.size() * sizeof(float)) ||
+            !in.read(reinterpret_cast<char *>(_lum_sqr.data()), _lum_sqr.size() * sizeof(float)))
+        {
+            return false;
+        }
+        width = _width;
+        height = _height;
+        seed = header.seed;
+        samples = header.samples;
+        passes = header.passes;
+        fingerprint = header.fingerprint;
+        color.swap(_color);
+        lum_sqr.swap(_lum_sqr);
+        return true;
+    }
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+
+// Picks index i with probability weights[i] / sum(weights) in constant time, whatever the number of entries.
+// Built with Vose's method: every slot holds its own index with some probability and one alias otherwise,
+// so a sample is one uniform number, one slot and one comparison.
+class AliasTable
+{
+public:
+    AliasTable() {}
+    AliasTable(const std::vector<double> &weights) { build(weights); }
+
+    void build(const std::vector<double> &weights)
+    {
+        int n = static_cast<int>(weights.size());
+        double total = 0;
+        for (auto w : weights)
+        {
+            total += w;
+        }
+        pmfs.assign(n, 0);
+        slots.assign(n, Slot());
+        if (n == 0 || total <= 0)
+        {
+            pmfs.clear();
+            slots.clear();
+            return;
+        }
+
+        // scaled so the average slot is 1, slots below that get topped up by ones above
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; i++)
+        {
+            pmfs[i] = weights[i] / total;
+            scaled[i] = pmfs[i] * n;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty())
+        {
+            int s = small.back(), l = large.back();
+            small.pop_back();
+            slots[s].probability = scaled[s];
+            slots[s].alias = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left is 1 up to rounding
+        for (int i : large)
+        {
+            slots[i].probability = 1;
+        }
+        for (int i : small)
+        {
+            slots[i].probability = 1;
+        }
+    }
+
+    int size() const { return static_cast<int>(slots.size()); }
+    double pmf(int index) const { return pmfs[index]; }
+
+    // u uniform in [0, 1), table must not be empty
+    int sample(double u, double &pmf) const
+    {
+        int n = size();
+        auto scaled = u * n;
+        int slot = static_cast<int>(scaled);
+        slot = slot < n ? slot : n - 1;
+        int index = scaled - slot < slots[slot].probability ? slot : slots[slot].alias;
+        pmf = pmfs[index];
+        return index;
+    }
+
+private:
+    struct Slot
+    {
+        double probability = 1;
+        int alias = 0;
+    };
+    std::vector<Slot> slots;
+    std::vector<double> pmfs;
+};
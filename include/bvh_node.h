@@ -6,6 +6,8 @@
 #include "utilities.h"
 #include "hittable.h"
 #include "hittable_array.h"
+#include "stats.h"
+#include "trace.h"
 
 // forming a tree of sorts where each node has two child nodes/leaves
 class BVHNode : public Hittable
@@ -14,6 +16,8 @@ public:
     BVHNode(const HittableArray &hittables) : BVHNode(hittables.objects, 0, hittables.objects.size()) {}
     BVHNode(const std::vector<std::shared_ptr<Hittable>> &scene_objects, int start, int end)
     {
+        // the whole build as one span, not every node of it
+        TraceScope scope(start == 0 && end == static_cast<int>(scene_objects.size()) ? "bvh build" : nullptr);
         // editable array
         auto objects = scene_objects;
 
@@ -47,12 +51,23 @@ public:
             right = std::make_shared<BVHNode>(objects, mid, end);
         }
         // done building
-        bbox = AABB(left->boundingBox(), right->boundingBox());
+        linkChildren();
+        updateBounds();
+        built_cost = cost;
     }
 
     bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
     {
-        if (!bbox.hit(ray, t_limits))
+        RT_STAT(STAT_BVH_NODES);
+        // a branch rather than a conditional, which would copy the static box into a temporary on every visit
+        if (is_moving)
+        {
+            if (!lerpBox(bbox_start, bbox_end, ray.time()).hit(ray, t_limits))
+            {
+                return false;
+            }
+        }
+        else if (!bbox.hit(ray, t_limits))
         {
             return false;
         }
@@ -63,19 +78,189 @@ public:
 
         return hit_left || hit_right;
     }
+    double transmittance(const Ray &ray, Interval t_limits) const override
+    {
+        RT_STAT(STAT_BVH_NODES);
+        if (is_moving)
+        {
+            if (!lerpBox(bbox_start, bbox_end, ray.time()).hit(ray, t_limits))
+            {
+                return 1;
+            }
+        }
+        else if (!bbox.hit(ray, t_limits))
+        {
+            return 1;
+        }
+        // any blocker will do, there is no nearest one to find
+        auto result = left->transmittance(ray, t_limits);
+        return result <= 0 || right == left ? result : result * right->transmittance(ray, t_limits);
+    }
 
     AABB boundingBox() const override { return bbox; }
+    AABB boundingBoxAt(double time) const override { return is_moving ? lerpBox(bbox_start, bbox_end, time) : bbox; }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        left->visitMaterials(visit);
+        // single object nodes point both sides at it
+        if (right != left)
+        {
+            right->visitMaterials(visit);
+        }
+    }
+    void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const override
+    {
+        left->visitLights(visit);
+        if (right != left)
+        {
+            right->visitLights(visit);
+        }
+    }
+
+    // for animation, call after primitives moved to update every box bottom up (much cheaper than a rebuild).
+    // the tree topology is kept, so its quality drops as things drift, returns the new sah cost
+    double refit()
+    {
+        if (left_node != nullptr)
+        {
+            left_node->refit();
+        }
+        if (right_node != nullptr && right_node != left_node)
+        {
+            right_node->refit();
+        }
+        updateBounds();
+        return cost;
+    }
+
+    // rebuilds from scratch the largest subtrees whose sah cost grew past threshold times their cost when built.
+    // returns how many subtrees were rebuilt
+    int rebuildDegraded(double threshold)
+    {
+        if (cost > threshold * built_cost)
+        {
+            rebuild();
+            return 1;
+        }
+        int rebuilt = 0;
+        if (left_node != nullptr)
+        {
+            rebuilt += left_node->rebuildDegraded(threshold);
+        }
+        if (right_node != nullptr && right_node != left_node)
+        {
+            rebuilt += right_node->rebuildDegraded(threshold);
+        }
+        if (rebuilt > 0)
+        {
+            updateBounds();
+        }
+        return rebuilt;
+    }
+
+    void rebuild()
+    {
+        std::vector<std::shared_ptr<Hittable>> leaves;
+        collectLeaves(leaves);
+        BVHNode fresh(leaves, 0, leaves.size());
+        left = fresh.left;
+        right = fresh.right;
+        linkChildren();
+        updateBounds();
+        built_cost = cost;
+    }
+
+    void collectLeaves(std::vector<std::shared_ptr<Hittable>> &leaves) const
+    {
+        if (left_node != nullptr)
+        {
+            left_node->collectLeaves(leaves);
+        }
+        else
+        {
+            leaves.push_back(left);
+        }
+        if (right == left)
+        {
+            return;
+        }
+        if (right_node != nullptr)
+        {
+            right_node->collectLeaves(leaves);
+        }
+        else
+        {
+            leaves.push_back(right);
+        }
+    }
+
+    // expected cost of a random ray through this subtree, traversal step and primitive test both counting as 1
+    double sahCost() const
+    {
+        auto area = bbox.surfaceArea();
+        return area > 0 ? cost / area : 0;
+    }
+
+    // a single object leaf stores the same child on both sides
+    const std::shared_ptr<Hittable> &leftChild() const { return left; }
+    const std::shared_ptr<Hittable> &rightChild() const { return right; }
 
 private:
     // these will also be bvh_nodes
     std::shared_ptr<Hittable> left;
     std::shared_ptr<Hittable> right;
     AABB bbox;
+    AABB bbox_start, bbox_end;
+    bool is_moving;
+    // children that are themselves nodes, cached so refits do not dynamic_cast every frame
+    BVHNode *left_node;
+    BVHNode *right_node;
+    double cost;
+    double built_cost;
+
+    void linkChildren()
+    {
+        left_node = dynamic_cast<BVHNode *>(left.get());
+        right_node = dynamic_cast<BVHNode *>(right.get());
+    }
+
+    void updateBounds()
+    {
+        bbox = AABB(left->boundingBox(), right->boundingBox());
+        // shutter open and close bounds, lerped by ray time during traversal.
+        // for fast movers these are far tighter than the union box above, which covers the whole sweep
+        bbox_start = AABB(left->boundingBoxAt(0), right->boundingBoxAt(0));
+        bbox_end = AABB(left->boundingBoxAt(1), right->boundingBoxAt(1));
+        is_moving = !sameBox(bbox_start, bbox) || !sameBox(bbox_end, bbox);
+
+        // kept unnormalized (surface area times cost), a node's own normalized cost can even drop as its box grows,
+        // this only ever grows as the subtree loosens, which is what the rebuild check wants
+        auto area_cost = [](const std::shared_ptr<Hittable> &child, const BVHNode *node)
+        { return node != nullptr ? node->cost : child->boundingBox().surfaceArea(); };
+        cost = bbox.surfaceArea() + area_cost(left, left_node);
+        if (right != left)
+        {
+            cost += area_cost(right, right_node);
+        }
+    }
+
+    static bool sameBox(const AABB &a, const AABB &b)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            if (a.getAxis(i).min != b.getAxis(i).min || a.getAxis(i).max != b.getAxis(i).max)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
     static bool compareBox(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis_index)
     {
         // returns a < b to order left and right accordingly
-        return a->boundingBox().getAxis(axis_index).min < b->boundingBox().getAxis(axis_index).min;
+        // sorting on the mid shutter box groups moving objects by where they are on average, not where their sweep starts
+        return a->boundingBoxAt(0.5).getAxis(axis_index).min < b->boundingBoxAt(0.5).getAxis(axis_index).min;
     }
     static bool compareBoxX(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b)
     {
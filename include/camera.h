@@ -8,6 +8,30 @@
 #include "ray.h"
 #include "color.h"
 #include "material.h"
+#include "material_table.h"
+#include "lights.h"
+#include "environment.h"
+#include "guiding.h"
+#include "caustics.h"
+#include "accumulator.h"
+#include "distributed.h"
+#include "sampler.h"
+#include "render_buffers.h"
+#include "denoiser.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "visibility.h"
+#include "tile_writer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <typeinfo>
 
 class Camera
 {
@@ -23,6 +47,8 @@ public:
     double defocus_angle = 0;
     double focus_distance = 10;
     Color background;
+    // where every random decision of a camera sample comes from, see sampler.h
+    std::shared_ptr<Sampler> sampler = std::make_shared<SobolSampler>();
 
     Camera() {}
     Camera(double _ar, int _img_width, int _samples_per_pixel, int _max_depth, double _vfov, Point3 _lookFrom, Point3 _lookAt, vec3 _vup, double _da, double _fd, Color _background) : aspect_ratio(_ar),
@@ -38,30 +64,164 @@ public:
                                                                                                                                                                     background(_background)
                                                                                                                                                                     {}
 
-    void render(Hittable &world)
-    {
-        initialize();
+    // optional extras, both cost an extra image sized set of buffers
+    bool denoise = false;   // runs the edge avoiding denoiser over the image before writing it
+    std::string aov_prefix; // when set, albedo, normal, depth and variance images are written as aov_prefix_*.ppm
+    // shade through a flat MaterialTable of the scene (switch dispatch, inlined constants), false for plain virtual calls
+    bool flat_materials = true;
+    // how lights are picked for light sampling (next event estimation), see lights.h
+    LightSelection light_selection = LIGHTS_BVH;
+    // image based lighting, when set rays that escape the scene see this instead of the constant background
+    std::shared_ptr<EnvironmentLight> environment;
+    // path guiding: a few training passes learn where light arrives from all over the scene (guiding.h),
+    // then diffuse bounces follow that instead of the material alone
+    bool guiding = false;
+    int guiding_passes = 5;        // pass k renders 2^k samples per pixel on top of samples_per_pixel, blended into the image
+    double guiding_fraction = 0.5; // share of bounces that follow the guide until each region has learned its own
+    // photon mapped caustics (caustics.h): light through glass or off metal onto diffuse surfaces is gathered from
+    // photons shot from the lights instead of waiting for camera paths to find it
+    bool caustics = false;
+    int caustic_passes = 8;       // samples_per_pixel is split over this many passes, each with a fresh photon map
+    int caustic_photons = 200000; // photons shot per pass
+    double caustic_radius = 0;    // gather radius of the first pass, shrinking every pass. 0 is 1/200 of the scene's size
+    // progressive rendering: samples_per_pixel is reached in full frame passes of progressive_spp samples, summed into
+    // a float accumulator (accumulator.h). 0 renders every pixel to the end in one go
+    int progressive_spp = 0;
+    std::string checkpoint_path; // when set, a progressive render resumes from here and saves here after every pass
+    std::string scene_name;      // recorded in checkpoints, so one scene's is not resumed by another
+    std::string preview_path;    // when set, a progressive render writes the image so far here now and then
+    double preview_interval = 10; // seconds between previews
+    // time budgeted rendering: when above 0, the render (scene setup not included) stops after about this many
+    // seconds, progressive passes are sized from the measured cost of the ones before. samples_per_pixel is then the
+    // most it may reach
+    double time_budget = 0;
+    // samples per pixel the last render ended up with, less than samples_per_pixel when the time budget ran out
+    int achieved_spp = 0;
+    // lines, tiles or passes remaining on std::clog as the render goes, off for tools that print results of their own
+    bool progress = true;
+    // with statistics compiled in, whether a render resets the process wide counters at its start and reports them at
+    // its end. off for renders that share the process with others running at the same time (render_server.h)
+    bool statistics = true;
+    // rays the last render's paths traced in this process (bounces and shadow rays), not counting worker processes
+    uint64_t rays_traced = 0;
+    // with statistics compiled in (stats.h), every render prints a summary of its counts and, when set, writes them
+    // here as json
+    std::string stats_path;
+    // when set, what every pixel cost is written as false color heatmaps, heatmap_prefix_time.ppm and, with statistics
+    // compiled in, heatmap_prefix_nodes.ppm (bvh nodes visited) and heatmap_prefix_tests.ppm (primitive tests).
+    // such renders stay in this process, the costs are measured where the pixels are traced
+    std::string heatmap_prefix;
+    // camera rays find their first hit in per tile lists of what the tile can see instead of the bvh
+    // (visibility.h), the same hits for less traversal. pinhole cameras only, ignored with defocus
+    bool visibility_bins = false;
+    // above 0, images are rendered tile by tile in this many forked worker processes (distributed.h)
+    int workers = 0;
+    int tile_size = 32;
+    // pixels [x0, x1) x [y0, y1) to render and write out, the rest of the image is skipped. empty for all of it
+    Tile crop = Tile{0, 0, 0, 0};
+    // when set, the image (the crop window of it) goes tile by tile into this binary ppm as tiles finish, in any order
+    // with workers, instead of to the output stream (tile_writer.h). only a tile of pixels is held at a time, for
+    // images too big to keep in memory. such a render is one plain pass: no guiding, caustics, progressive passes,
+    // denoising, AOVs or heatmaps
+    std::string stream_path;
+    // the last render's per pixel results, see render_buffers.h
+    RenderBuffers buffers;
 
-        std::cout << "P3\n"
-                  << img_width << " " << img_height << "\n255\n";
+    void render(Hittable &world, std::ostream &out = std::cout)
+    {
+        render_start = std::chrono::steady_clock::now();
+        rays_traced = 0;
+        if (statistics)
+        {
+            StatsRegistry::instance().reset();
+        }
+        {
+            TraceScope scope("render setup");
+            PerfScope counters("setup");
+            initialize();
+            // a streamed render sizes them to each tile as it goes
+            buffers.resize(stream_path.empty() ? img_width : 0, stream_path.empty() ? img_height : 0);
+            if (!heatmap_prefix.empty() && stream_path.empty())
+            {
+                buffers.trackCosts();
+            }
+            materials.clear();
+            if (flat_materials)
+            {
+                materials.build(world);
+            }
+            lights.build(world, light_selection);
+            first_sample = 0;
+            pass_color.assign(buffers.color.size(), Color(0, 0, 0));
+            pass_variance.assign(buffers.variance.size(), 0);
+            pass_samples = 0;
+            caustic_map = CausticMap();
+            visibility.clear();
+            if (visibility_bins && defocus_angle <= 0)
+            {
+                visibility.build(world, camera_center, -w, pixel_top_left, pixel_distance_u, pixel_distance_v, img_width, img_height, 16);
+            }
+        }
+        if (!stream_path.empty())
+        {
+            renderStreamed(world);
+            if (progress)
+            {
+                std::clog << "\rDone.           \n";
+            }
+            reportStats();
+            return;
+        }
+        if (guiding)
+        {
+            trainGuide(world);
+        }
 
-        for (int j = 0; j < img_height; ++j)
+        achieved_spp = samples_per_pixel;
+        if (progressive_spp > 0 || time_budget > 0)
+        {
+            renderProgressive(world);
+        }
+        else if (caustics)
         {
-            std::clog << "\rLines remaining" << (img_height - j) << ' ' << std::flush;
-            for (int i = 0; i < img_width; ++i)
+            renderCausticPasses(world);
+        }
+        else
+        {
+            renderImage(world, progress);
+            if (pass_samples > 0)
             {
-                // for normalization to 0.0.to 1.0 then map to 0 to 255 inside writeColor
-                Color pixel_color(0, 0, 0);
-                for (int s = 0; s < samples_per_pixel; s++)
-                {
-                    // returns and adds random sample from 0.5 square with pixel at centre
-                    Ray r = getRay(i, j);
-                    pixel_color += rayColor(r, max_depth, world);
-                }
-                writeColor(std::cout, pixel_color, samples_per_pixel);
+                keepPass();
+            }
+        }
+        if (pass_samples > 0)
+        {
+            blendPasses();
+        }
+        if (!aov_prefix.empty() && !buffers.writeAOVs(aov_prefix))
+        {
+            std::clog << "\rCould not write AOV images to " << aov_prefix << "_*.ppm\n";
+        }
+        if (!heatmap_prefix.empty() && !buffers.writeCostMaps(heatmap_prefix, stats_compiled))
+        {
+            std::clog << "\rCould not write heatmaps to " << heatmap_prefix << "_*.ppm\n";
+        }
+        if (denoise)
+        {
+            if (progress)
+            {
+                std::clog << "\rDenoising.           " << std::flush;
             }
+            TraceScope scope("denoise");
+            Denoiser().denoise(buffers);
+        }
+
+        writeImage(out);
+        if (progress)
+        {
+            std::clog << "\rDone.           \n";
         }
-        std::clog << "\rDone.           \n";
+        reportStats();
     }
 
 private:
@@ -75,12 +235,28 @@ private:
     vec3 defocus_disk_u;
     vec3 defocus_disk_v;
 
+    MaterialTable materials; // rebuilt every render, empty when flat_materials is off
+    LightSet lights;         // rebuilt every render too
+    GuidingCache guide;      // trained at the start of every render with guiding on
+    bool guide_recording = false;
+    CausticMap caustic_map;  // the current caustic pass's photons, empty without caustics
+    VisibilityBins visibility; // empty without visibility_bins
+    Accumulator accumulator; // sums of a progressive render
+    std::chrono::steady_clock::time_point render_start;
+    // the images and variances of renders done in passes (guide training, caustics), summed weighted by their
+    // sample counts
+    std::vector<Color> pass_color;
+    std::vector<double> pass_variance;
+    int pass_samples = 0;
+    int first_sample = 0; // index of the pass's first sample in each pixel's sequence, after any earlier passes
+
     // to achieve old orthographic view, make u,v,w unit axis vectors by adjusting lookFrom = (0, 0, -1), lookAt = (0, 0, 0) and cameraUp = (0, 1, 0)
     vec3 u, v, w; // camera basis vectors, v - cameraUp projected orthonormal to view dir, w - along view dir, u - cameraRight
     void initialize()
     {
         img_height = static_cast<int>(img_width / aspect_ratio);
         img_height = img_height < 1 ? 1 : img_height;
+        sampler->setSamplesPerPixel(samples_per_pixel);
 
         // real value viewport dimensions are ok, img dimensions are not (they represent number of pixels)
         camera_center = lookFrom;
@@ -114,21 +290,496 @@ private:
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
     }
-    Color rayColor(const Ray &r, int depth, const Hittable &world)
+    // renders passes that fill the guiding cache, keeping their images to blend into the final one.
+    // the passes and the final render take consecutive runs of one sequence of pixel samples, so between them they
+    // are spread as evenly as a single render of all those samples would be
+    void trainGuide(const Hittable &world)
+    {
+        TraceScope scope("guide training");
+        guide.reset(world.boundingBox(), guiding_fraction);
+        auto final_spp = samples_per_pixel;
+        sampler->setSamplesPerPixel((1 << guiding_passes) - 1 + final_spp);
+        guide_recording = true;
+        for (int pass = 0; pass < guiding_passes; pass++)
+        {
+            if (progress)
+            {
+                std::clog << "\rTraining guide, pass " << pass + 1 << " of " << guiding_passes << "      " << std::flush;
+            }
+            samples_per_pixel = 1 << pass;
+            renderImage(world, false);
+            guide.refine(pass);
+            keepPass();
+            first_sample += samples_per_pixel;
+        }
+        guide_recording = false;
+        samples_per_pixel = final_spp;
+    }
+
+    // the final samples split into passes, each gathering from its own photon map with a smaller radius than the last.
+    // a pass's blur (bias) shrinks with the radius while the average over passes keeps the noise down
+    void renderCausticPasses(const Hittable &world)
+    {
+        auto final_spp = samples_per_pixel;
+        int passes = std::max(1, std::min(caustic_passes, final_spp));
+        auto radius = causticRadius(world, 0);
+        for (int pass = 0; pass < passes; pass++)
+        {
+            if (progress)
+            {
+                std::clog << "\rCaustic pass " << pass + 1 << " of " << passes << "      " << std::flush;
+            }
+            samples_per_pixel = final_spp / passes + (pass < final_spp % passes ? 1 : 0);
+            caustic_map.build(world, materials, *sampler, caustic_photons, radius, max_depth, pass);
+            renderImage(world, progress && passes == 1);
+            keepPass();
+            first_sample += samples_per_pixel;
+            radius = CausticMap::shrinkRadius(radius, pass);
+        }
+        samples_per_pixel = final_spp;
+    }
+
+    // gather radius of caustic pass iteration
+    double causticRadius(const Hittable &world, int iteration) const
+    {
+        auto radius = caustic_radius;
+        if (radius <= 0)
+        {
+            auto box = world.boundingBox();
+            radius = 0.005 * vec3(box.x.size(), box.y.size(), box.z.size()).length();
+        }
+        for (int pass = 0; pass < iteration; pass++)
+        {
+            radius = CausticMap::shrinkRadius(radius, pass);
+        }
+        return radius;
+    }
+
+    // what a checkpoint must have been rendered with, besides the image size, to be resumed: the scene (by name and
+    // bounds), the sampler, the depth and the crop window
+    std::string checkpointSettings(const Hittable &world) const
+    {
+        auto box = world.boundingBox();
+        std::string settings = scene_name + ' ' + typeid(*sampler).name() + ' ' + std::to_string(max_depth);
+        for (auto value : {crop.x0, crop.y0, crop.x1, crop.y1})
+        {
+            settings += ' ' + std::to_string(value);
+        }
+        for (auto value : {box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max})
+        {
+            settings += ' ' + std::to_string(value);
+        }
+        return settings;
+    }
+
+    // passes of progressive_spp samples until every pixel has samples_per_pixel, each one added to the accumulator,
+    // checkpointed and, now and then, written out as a preview. a checkpoint for the same image size and settings
+    // (checkpointSettings) picks up where its render stopped: same sampler seed, the pixel sequences continued from its
+    // sample count. raising samples_per_pixel for a finished checkpoint just keeps adding samples. guide training is
+    // redone on every run and only teaches the guide, the image comes from the accumulator alone.
+    // with a time budget the first pass is a single sample to measure the cost of one, every later pass as many samples
+    // as fit in what is left (at most doubling the run's samples, and capped at progressive_spp when set to keep
+    // checkpoints coming), until not even one does
+    void renderProgressive(const Hittable &world)
+    {
+        auto fingerprint = checkpointFingerprint(checkpointSettings(world));
+        if (!checkpoint_path.empty() && accumulator.load(checkpoint_path, img_width, img_height, fingerprint))
+        {
+            sampler->setSeed(accumulator.seed);
+            std::clog << "\rResuming " << checkpoint_path << " at " << accumulator.samples << " samples per pixel\n";
+        }
+        else
+        {
+            accumulator.reset(img_width, img_height, sampler->getSeed(), fingerprint);
+        }
+        pass_samples = 0;
+        auto final_spp = samples_per_pixel;
+        auto training_samples = first_sample;
+        auto last_preview = std::chrono::steady_clock::now();
+        auto deadline = render_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(time_budget));
+        // this run's cost so far, the per pass part (photon maps) and the per sample part
+        double pass_seconds = 0, sample_seconds = 0;
+        int traced = 0;
+        while (static_cast<int>(accumulator.samples) < final_spp)
+        {
+            auto spp = final_spp - static_cast<int>(accumulator.samples);
+            spp = progressive_spp > 0 ? std::min(progressive_spp, spp) : spp;
+            if (time_budget > 0)
+            {
+                auto left = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+                // a little slack, overrunning is worse than a sample less
+                auto fit = traced > 0 ? (0.95 * left - pass_seconds) / (sample_seconds / traced) : 1;
+                if (fit < 1 && accumulator.samples > 0)
+                {
+                    break;
+                }
+                // clamped while still a double, fit is huge or infinite when the samples so far took next to no time
+                auto fits = static_cast<int>(std::max(1.0, std::min(fit, static_cast<double>(spp))));
+                // at most doubling what this run traced, so the estimate firms up before the big passes
+                spp = std::min({spp, traced > 0 ? traced : 1, fits});
+            }
+            if (progress)
+            {
+                std::clog << "\rProgressive pass " << accumulator.passes + 1 << ", " << accumulator.samples << " of "
+                          << final_spp << " samples per pixel      " << std::flush;
+            }
+            samples_per_pixel = spp;
+            first_sample = training_samples + accumulator.samples;
+            // what still draws from rand() (the independent sampler, volumes) repeats on a resume as well
+            srand(Sampler::hash(accumulator.seed ^ accumulator.passes));
+            auto pass_start = std::chrono::steady_clock::now();
+            if (caustics)
+            {
+                caustic_map.build(world, materials, *sampler, caustic_photons, causticRadius(world, accumulator.passes), max_depth, accumulator.passes);
+            }
+            auto trace_start = std::chrono::steady_clock::now();
+            renderImage(world, false);
+            pass_seconds = std::chrono::duration<double>(trace_start - pass_start).count();
+            sample_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - trace_start).count();
+            traced += spp;
+            accumulator.add(buffers, samples_per_pixel);
+            if (!checkpoint_path.empty() && !accumulator.save(checkpoint_path))
+            {
+                std::clog << "\rCould not save checkpoint " << checkpoint_path << '\n';
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (!preview_path.empty() && std::chrono::duration<double>(now - last_preview).count() >= preview_interval)
+            {
+                accumulator.resolve(buffers);
+                writePreview();
+                last_preview = now;
+            }
+        }
+        samples_per_pixel = final_spp;
+        achieved_spp = accumulator.samples;
+        accumulator.resolve(buffers);
+        if (time_budget > 0)
+        {
+            std::clog << "\rTime budget " << time_budget << " s: " << achieved_spp << " of " << final_spp
+                      << " samples per pixel in "
+                      << std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count() << " s\n";
+        }
+    }
+    void writePreview()
+    {
+        // renamed into place, so a viewer never sees half an image
+        auto temp = preview_path + ".tmp";
+        {
+            std::ofstream out(temp);
+            writeImage(out);
+        }
+        if (std::rename(temp.c_str(), preview_path.c_str()) != 0)
+        {
+            std::clog << "\rCould not write preview " << preview_path << '\n';
+        }
+    }
+
+    void reportStats() const
+    {
+        if (!statistics)
+        {
+            return;
+        }
+#ifdef RT_STATS
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+        auto stats = StatsRegistry::instance().total();
+        stats.print(std::clog, seconds);
+        if (workers > 0)
+        {
+            std::clog << "  (the worker processes' counts are not included)\n";
+        }
+        if (!stats_path.empty() && !stats.writeJson(stats_path, seconds))
+        {
+            std::clog << "Could not write statistics to " << stats_path << '\n';
+        }
+#else
+        if (!stats_path.empty())
+        {
+            std::clog << "Statistics are not compiled in, configure with -DRAYCASTER_STATS=ON\n";
+        }
+#endif
+    }
+
+    void writeImage(std::ostream &out) const
+    {
+        TraceScope scope("output");
+        PerfScope counters("output");
+        auto area = window();
+        out << "P3\n"
+            << area.x1 - area.x0 << " " << area.y1 - area.y0 << "\n255\n";
+        for (int j = area.y0; j < area.y1; j++)
+        {
+            for (int i = area.x0; i < area.x1; i++)
+            {
+                // buffers already hold the average of the samples
+                writeColor(out, buffers.color[buffers.index(i, j)], 1);
+            }
+        }
+    }
+    // the crop window inside the image, the whole image without one
+    Tile window() const
+    {
+        Tile area{std::max(crop.x0, 0), std::max(crop.y0, 0), std::min(crop.x1, img_width), std::min(crop.y1, img_height)};
+        if (area.x0 >= area.x1 || area.y0 >= area.y1)
+        {
+            return Tile{0, 0, img_width, img_height};
+        }
+        return area;
+    }
+
+    void renderImage(const Hittable &world, bool progress = true)
+    {
+        TraceScope scope("trace");
+        PerfScope counters("trace");
+        // training passes record into the guide, which would stay behind in the workers, as would pixel costs
+        if (workers > 0 && !guide_recording && buffers.seconds.empty())
+        {
+            renderTiles(world, progress);
+            return;
+        }
+        auto area = window();
+        for (int j = area.y0; j < area.y1; ++j)
+        {
+            if (progress)
+            {
+                std::clog << "\rLines remaining" << (area.y1 - j) << ' ' << std::flush;
+            }
+            TraceScope line("line", "tile");
+            for (int i = area.x0; i < area.x1; ++i)
+            {
+                renderPixel(i, j, world);
+            }
+        }
+    }
+
+    // a pixel's results as a worker sends them: color, albedo, normal, depth, variance
+    static const int tile_values = 11;
+    void renderTiles(const Hittable &world, bool progress)
+    {
+        TileFarm farm;
+        auto render = [&](const Tile &tile, std::vector<float> &values)
+        {
+            // rand() (independent sampler, volumes) would run the same sequence in every worker, and then depend on
+            // which worker got the tile
+            srand(Sampler::hash(Sampler::hash(tile.x0 ^ Sampler::hash(tile.y0)) ^ first_sample));
+            size_t v = 0;
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    renderPixel(i, j, world);
+                    int k = buffers.index(i, j);
+                    const vec3 *parts[] = {&buffers.color[k], &buffers.albedo[k], &buffers.normal[k]};
+                    for (auto part : parts)
+                    {
+                        for (int c = 0; c < 3; c++)
+                        {
+                            values[v++] = static_cast<float>((*part)[c]);
+                        }
+                    }
+                    values[v++] = static_cast<float>(buffers.depth[k]);
+                    values[v++] = static_cast<float>(buffers.variance[k]);
+                }
+            }
+        };
+        auto merge = [&](const Tile &tile, const std::vector<float> &values)
+        {
+            size_t v = 0;
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    int k = buffers.index(i, j);
+                    buffers.color[k] = Color(values[v], values[v + 1], values[v + 2]);
+                    buffers.albedo[k] = Color(values[v + 3], values[v + 4], values[v + 5]);
+                    buffers.normal[k] = vec3(values[v + 6], values[v + 7], values[v + 8]);
+                    buffers.depth[k] = values[v + 9];
+                    buffers.variance[k] = values[v + 10];
+                    v += tile_values;
+                }
+            }
+        };
+        farm.run(window(), tile_size, workers, tile_values, render, merge, progress);
+    }
+
+    // the image into stream_path a tile at a time: each tile is rendered into buffers the size of the tile, in a worker
+    // or here, and comes back as output bytes that go straight to their place in the file
+    void renderStreamed(const Hittable &world)
+    {
+        TraceScope scope("trace");
+        PerfScope counters("trace");
+        if (guiding || caustics || progressive_spp > 0 || time_budget > 0 || denoise || !aov_prefix.empty() || !heatmap_prefix.empty())
+        {
+            std::clog << "\rStreamed renders are a single plain pass, guiding, caustics, progressive passes, denoising, AOVs and heatmaps are skipped\n";
+        }
+        auto area = window();
+        TileWriter writer;
+        if (!writer.open(stream_path, area))
+        {
+            std::clog << "\rCould not open " << stream_path << " for writing\n";
+            return;
+        }
+        TileFarm farm;
+        auto render = [&](const Tile &tile, std::vector<float> &values)
+        {
+            // as in renderTiles, so the image does not depend on which worker got which tile
+            srand(Sampler::hash(Sampler::hash(tile.x0 ^ Sampler::hash(tile.y0)) ^ first_sample));
+            buffers.resize(tile.x1 - tile.x0, tile.y1 - tile.y0, tile.x0, tile.y0);
+            size_t v = 0;
+            for (int j = tile.y0; j < tile.y1; j++)
+            {
+                for (int i = tile.x0; i < tile.x1; i++)
+                {
+                    renderPixel(i, j, world);
+                    // quantized where the pixel is, floats carry the bytes exactly
+                    const auto &c = buffers.color[buffers.index(i, j)];
+                    values[v++] = static_cast<float>(colorByte(c.x()));
+                    values[v++] = static_cast<float>(colorByte(c.y()));
+                    values[v++] = static_cast<float>(colorByte(c.z()));
+                }
+            }
+        };
+        std::vector<unsigned char> bytes;
+        bool written = true;
+        auto merge = [&](const Tile &tile, const std::vector<float> &values)
+        {
+            bytes.assign(values.begin(), values.end());
+            written = writer.write(tile, bytes.data()) && written;
+        };
+        farm.run(area, tile_size, workers, 3, render, merge, progress);
+        if (!writer.close() || !written)
+        {
+            std::clog << "\rCould not write " << stream_path << '\n';
+        }
+    }
+
+    // every pass is an unbiased (or, with caustics, consistent) image on its own, so none of them goes to waste:
+    // the image is the average over the samples of all passes
+    void keepPass()
+    {
+        for (size_t k = 0; k < pass_color.size(); k++)
+        {
+            pass_color[k] += samples_per_pixel * buffers.color[k];
+            pass_variance[k] += samples_per_pixel * samples_per_pixel * buffers.variance[k];
+        }
+        pass_samples += samples_per_pixel;
+    }
+    void blendPasses()
+    {
+        double total = pass_samples;
+        for (size_t k = 0; k < pass_color.size(); k++)
+        {
+            buffers.color[k] = pass_color[k] / total;
+            buffers.variance[k] = pass_variance[k] / (total * total);
+        }
+    }
+
+    void renderPixel(int i, int j, const Hittable &world)
+    {
+        // for normalization to 0.0.to 1.0 then map to 0 to 255 inside writeColor
+        Color pixel_color(0, 0, 0);
+        Color albedo(0, 0, 0);
+        vec3 normal(0, 0, 0);
+        double depth = 0, lum_sum = 0, lum_sqr_sum = 0;
+        bool costs = !buffers.seconds.empty();
+        std::chrono::steady_clock::time_point start;
+        RenderStats counted;
+        if (costs)
+        {
+            start = std::chrono::steady_clock::now();
+            counted = threadStats();
+        }
+        for (int s = 0; s < samples_per_pixel; s++)
+        {
+            // returns and adds random sample from 0.5 square with pixel at centre
+            Ray r = getRay(i, j, s);
+            FirstHit first;
+            first.bin = visibility.binAt(i, j);
+            auto sample = rayColor(r, max_depth, world, &first);
+            pixel_color += sample;
+            albedo += first.albedo;
+            normal += first.normal;
+            depth += first.depth;
+            auto lum = luminance(sample);
+            lum_sum += lum;
+            lum_sqr_sum += lum * lum;
+        }
+        auto scale = 1.0 / samples_per_pixel;
+        int k = buffers.index(i, j);
+        buffers.color[k] = scale * pixel_color;
+        buffers.albedo[k] = scale * albedo;
+        buffers.normal[k] = normal.sqrLength() > 0 ? normalize(normal) : normal;
+        buffers.depth[k] = scale * depth;
+        // sample variance over n, the variance of the pixel's mean
+        auto mean = lum_sum * scale;
+        buffers.variance[k] = samples_per_pixel > 1 ? fmax(0.0, lum_sqr_sum * scale - mean * mean) / (samples_per_pixel - 1) : 0;
+        if (costs)
+        {
+            // summed over passes, the costs are of the whole render
+            buffers.seconds[k] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const auto &now = threadStats();
+            buffers.nodes[k] += now[STAT_BVH_NODES] - counted[STAT_BVH_NODES];
+            buffers.tests[k] += now.primitiveTests() - counted.primitiveTests();
+        }
+    }
+
+    // guide values from where a camera ray first lands
+    struct FirstHit
+    {
+        Color albedo;
+        vec3 normal;
+        double depth = 0;
+        const Hittable *bin = nullptr; // the pixel's visibility bin, what the camera ray is traced against instead of the world
+    };
+
+    // where a bounce ray left from, to weigh the light it runs into against light sampling having found it
+    struct Bounce
+    {
+        Point3 p;
+        vec3 normal;    // zero inside media
+        double pdf = 0; // density the bounce's direction was picked with, zero for specular bounces
+        DirectionalTree *guide = nullptr; // guiding cache cell at p, when guiding
+        bool gathered = false; // the path took caustic photons at its last diffuse hit, only specular bounces since
+    };
+
+    Color rayColor(const Ray &r, int depth, const Hittable &world, FirstHit *first = nullptr, const Bounce *from = nullptr)
     {
         hit_info info;
 
         // to prevent that nasty seg fault u were getting
         if (depth <= 0)
         {
+            RT_STAT(STAT_PATHS_DEPTH_LIMIT);
+            RT_STAT_ADD(STAT_PATH_BOUNCES, max_depth);
             return Color(0, 0, 0);
         }
         // interval starts from small t to fix shadow acne
         // shadow acne was actually the issue causing major runtime lag and visual defect for me.
         // reintersection is a bitch.
-        if (!world.hit(r, Interval(0.001, infinity), info))
+        rays_traced++;
+        RT_STAT(first != nullptr ? STAT_PRIMARY_RAYS : STAT_SECONDARY_RAYS);
+        const Hittable &scene = first != nullptr && first->bin != nullptr ? *first->bin : world;
+        if (!scene.hit(r, Interval(0.001, infinity), info))
+        {
+            RT_STAT(STAT_PATHS_ESCAPED);
+            RT_STAT_ADD(STAT_PATH_BOUNCES, max_depth - depth);
+            Color sky = environment ? environment->value(r.direction()) : background;
+            if (first != nullptr)
+            {
+                first->albedo = sky;
+            }
+            if (from != nullptr && from->pdf > 0 && environmentPickProbability() > 0)
+            {
+                auto light_pdf = environmentPickProbability() * environment->pdfValue(r.direction());
+                return powerHeuristic(from->pdf, light_pdf) * sky;
+            }
+            return sky;
+        }
+        if (first != nullptr)
         {
-            return background;
+            first->albedo = materials.surfaceAlbedo(info);
+            first->normal = info.normal;
+            first->depth = info.t * r.direction().length();
         }
         // understand the geometric meaning of this recursive call, basically how the rays travel on each rayColor
         // first call from render will give ray bw camera and sample point
@@ -137,18 +788,225 @@ private:
         Ray scattered;
         Color attenuation; // learn what these are in depth asap
         // so for lambertian, we took attenuation = 0.5, scattered ofc based on principle
-        Color emitted_color = info.mat->emitted(info.u, info.v, info.p);
-        if (!info.mat->scatter(r, info, attenuation, scattered))
+        Color emitted_color = materials.emitted(info);
+        if (from != nullptr && from->pdf > 0)
         {
+            emitted_color = bounceWeight(r, info, *from) * emitted_color;
+        }
+        else if (from != nullptr && from->gathered && caustic_map.emitsPhotons(info.object))
+        {
+            // diffuse, specular bounces, light: the caustic photons already carried this
+            emitted_color = Color(0, 0, 0);
+        }
+        int bounce = max_depth - depth;
+        sampler->startBounce(bounce);
+        if (!materials.scatter(r, info, attenuation, scattered, *sampler))
+        {
+            RT_STAT(STAT_PATHS_ABSORBED);
+            RT_STAT_ADD(STAT_PATH_BOUNCES, bounce);
             return emitted_color;
         }
-        Color scattered_color = attenuation * rayColor(scattered, depth - 1, world);
-        return emitted_color + scattered_color;
+        // light sampling and guiding only make sense for lobes with a density, specular bounces just follow the ray
+        Bounce next;
+        Color direct_color(0, 0, 0);
+        auto scatter_pdf = materials.scatteringPdf(r, info, scattered);
+        if (scatter_pdf <= 0)
+        {
+            next.gathered = from != nullptr && from->gathered;
+        }
+        else
+        {
+            next.p = info.p;
+            next.normal = materials.isVolumetric(info) ? vec3(0, 0, 0) : info.normal;
+            if (caustic_map.size() > 0 && !materials.isVolumetric(info))
+            {
+                direct_color += gatherCaustics(r, info, attenuation);
+                next.gathered = true;
+            }
+            if (guiding)
+            {
+                next.guide = guide.find(info.p);
+                sampler->startGuideSample(bounce);
+                if (guide.isTrained() && sampler->get1D() < next.guide->guidingFraction())
+                {
+                    double u1, u2;
+                    sampler->get2D(u1, u2);
+                    scattered = Ray(info.p, guideDirection(next, u1, u2), r.time());
+                    scatter_pdf = materials.scatteringPdf(r, info, scattered);
+                }
+            }
+            next.pdf = bouncePdf(next, scattered.direction(), scatter_pdf);
+            if (lights.size() > 0 || environmentPickProbability() > 0)
+            {
+                direct_color += sampleLight(r, info, attenuation, next, bounce, world);
+            }
+            if (scatter_pdf <= 0)
+            {
+                // the guide picked a direction the material does not scatter into
+                RT_STAT(STAT_PATHS_ABSORBED);
+                RT_STAT_ADD(STAT_PATH_BOUNCES, bounce);
+                return emitted_color + direct_color;
+            }
+        }
+        Color incoming = rayColor(scattered, depth - 1, world, nullptr, &next);
+        if (guide_recording && next.guide != nullptr)
+        {
+            auto direction = normalize(scattered.direction());
+            next.guide->record(direction, luminance(incoming) / next.pdf);
+            if (guide.isTrained())
+            {
+                next.guide->recordShares(luminance(scatter_pdf * attenuation * incoming), guidePdf(next, direction), scatter_pdf, next.pdf);
+            }
+        }
+        // attenuation * scatter_pdf is the material's share, next.pdf what the direction was actually picked with
+        Color throughput = scatter_pdf > 0 ? (scatter_pdf / next.pdf) * attenuation : attenuation;
+        return emitted_color + direct_color + throughput * incoming;
+    }
+
+    // density of picking direction at a bounce, the material's own when not guiding, the mix of both when guiding
+    double bouncePdf(const Bounce &at, const vec3 &direction, double scatter_pdf) const
+    {
+        if (at.guide == nullptr || !guide.isTrained() || at.guide->guidingFraction() <= 0)
+        {
+            return scatter_pdf;
+        }
+        auto fraction = at.guide->guidingFraction();
+        return (1 - fraction) * scatter_pdf + fraction * guidePdf(at, direction);
+    }
+    double guidePdf(const Bounce &at, const vec3 &direction) const
+    {
+        auto d = normalize(direction);
+        auto pdf = at.guide->pdf(d);
+        if (at.normal.sqrLength() > 0)
+        {
+            // both directions guideDirection folds onto d
+            pdf += at.guide->pdf(mirror(d, at.normal));
+        }
+        return pdf;
+    }
+    // a cache cell mixes surfaces facing different ways, so on a surface the guide's directions below it are folded
+    // back above it rather than wasted
+    vec3 guideDirection(const Bounce &at, double u1, double u2) const
+    {
+        auto d = at.guide->sample(u1, u2);
+        return d.dot(at.normal) < 0 ? mirror(d, at.normal) : d;
+    }
+    static vec3 mirror(const vec3 &d, const vec3 &n) { return d - 2 * d.dot(n) * n; }
+
+    // density estimate of the caustic light leaving a diffuse hit towards the ray: the photons within the radius,
+    // each times the material's response to its direction, over the disc they were collected from
+    Color gatherCaustics(const Ray &r, const hit_info &info, const Color &attenuation) const
+    {
+        Color sum(0, 0, 0);
+        caustic_map.gather(info.p, [&](const CausticMap::Photon &photon)
+                           {
+            vec3 towards(-photon.direction[0], -photon.direction[1], -photon.direction[2]);
+            auto cosine = towards.dot(info.normal);
+            // photons that came in on the other side of the surface do not light this one
+            if (cosine <= 0)
+                return;
+            auto pdf = materials.scatteringPdf(r, info, Ray(info.p, towards, r.time()));
+            sum += (pdf / cosine) * Color(photon.power[0], photon.power[1], photon.power[2]); });
+        auto radius = caustic_map.gatherRadius();
+        return attenuation * sum / (pi * radius * radius);
+    }
+
+    // next event estimation: aims one ray at a light picked by the light set, weighted against the chance the
+    // material's own sampling had of going there (multiple importance sampling, power heuristic)
+    Color sampleLight(const Ray &r, hit_info &info, const Color &attenuation, const Bounce &at, int bounce, const Hittable &world)
+    {
+        sampler->startLightSample(bounce);
+        auto u = sampler->get1D();
+        double u1, u2;
+        sampler->get2D(u1, u2);
+        // the environment and the scene's lights share the sample, u is rescaled to what is left after the choice
+        auto environment_probability = environmentPickProbability();
+        if (u < environment_probability)
+        {
+            return sampleEnvironment(r, info, attenuation, at, u / environment_probability, u1, u2, world);
+        }
+        u = (u - environment_probability) / (1 - environment_probability);
+        int index;
+        double pick_pmf;
+        if (!lights.pick(at.p, at.normal, u, index, pick_pmf))
+        {
+            return Color(0, 0, 0);
+        }
+        pick_pmf *= 1 - environment_probability;
+        const auto &shape = *lights.light(index).shape;
+        Ray to_light(info.p, shape.randomDirection(info.p, r.time(), u1, u2), r.time());
+        auto light_pdf = pick_pmf * shape.pdfValue(info.p, to_light.direction(), r.time());
+        auto scatter_pdf = materials.scatteringPdf(r, info, to_light);
+        hit_info light_info;
+        if (light_pdf <= 0 || scatter_pdf <= 0 || !shape.hit(to_light, Interval(0.001, infinity), light_info))
+        {
+            return Color(0, 0, 0);
+        }
+        rays_traced++;
+        RT_STAT(STAT_SHADOW_RAYS);
+        // surfaces in between block it, media let some through
+        auto visible = world.transmittance(to_light, Interval(0.001, light_info.t * (1 - 1e-6)));
+        if (visible <= 0)
+        {
+            return Color(0, 0, 0);
+        }
+        auto weight = powerHeuristic(light_pdf, bouncePdf(at, to_light.direction(), scatter_pdf));
+        return (visible * weight * scatter_pdf / light_pdf) * attenuation * materials.emitted(light_info);
+    }
+
+    Color sampleEnvironment(const Ray &r, hit_info &info, const Color &attenuation, const Bounce &at, double u, double u1, double u2, const Hittable &world)
+    {
+        vec3 direction;
+        double environment_pdf;
+        if (!environment->sample(u, u1, u2, direction, environment_pdf))
+        {
+            return Color(0, 0, 0);
+        }
+        Ray to_sky(info.p, direction, r.time());
+        auto light_pdf = environmentPickProbability() * environment_pdf;
+        auto scatter_pdf = materials.scatteringPdf(r, info, to_sky);
+        rays_traced += scatter_pdf > 0;
+        RT_STAT_ADD(STAT_SHADOW_RAYS, scatter_pdf > 0);
+        auto visible = scatter_pdf > 0 ? world.transmittance(to_sky, Interval(0.001, infinity)) : 0;
+        if (visible <= 0)
+        {
+            return Color(0, 0, 0);
+        }
+        auto weight = powerHeuristic(light_pdf, bouncePdf(at, direction, scatter_pdf));
+        return (visible * weight * scatter_pdf / light_pdf) * attenuation * environment->value(direction);
+    }
+    // share of light samples that go to the environment, an even split when there are lights in the scene too
+    double environmentPickProbability() const
+    {
+        if (!environment || !environment->valid() || light_selection == LIGHTS_NONE)
+        {
+            return 0;
+        }
+        return lights.size() > 0 ? 0.5 : 1.0;
+    }
+
+    // the light side of the same weighting, for a bounce that ran into a light
+    double bounceWeight(const Ray &r, const hit_info &info, const Bounce &from) const
+    {
+        int index = lights.find(info.object);
+        if (index < 0)
+        {
+            return 1;
+        }
+        auto light_pdf = (1 - environmentPickProbability()) * lights.pmf(from.p, from.normal, index) *
+                         lights.light(index).shape->pdfValue(from.p, r.direction(), r.time());
+        return powerHeuristic(from.pdf, light_pdf);
+    }
+
+    static double powerHeuristic(double pdf, double other_pdf)
+    {
+        return pdf * pdf / (pdf * pdf + other_pdf * other_pdf);
     }
 
-    Ray getRay(int i, int j)
+    Ray getRay(int i, int j, int s)
     {
         // returns ray per sample
+        sampler->startPixelSample(i, j, first_sample + s);
         auto pixel_center = pixel_top_left + (i * pixel_distance_u) + (j * pixel_distance_v);
         auto pixel_sample = pixel_center + pixelSampleSquare();
 
@@ -156,20 +1014,25 @@ private:
         auto origin = (defocus_angle <= 0) ? camera_center : defocusDiskSample();
         auto direction_from_cam = pixel_sample - camera_center;
         // sends out rays at random times
-        auto ray_time = randomDouble();
+        sampler->setDimension(Sampler::time_dimension);
+        auto ray_time = sampler->get1D();
         return Ray(origin, direction_from_cam, ray_time);
     }
     vec3 pixelSampleSquare()
     {
         // returns random point in 0.5 square vicinity
-        auto px = -0.5 + randomDouble();
-        auto py = -0.5 + randomDouble();
+        double px, py;
+        sampler->get2D(px, py);
+        px -= 0.5;
+        py -= 0.5;
         return (px * pixel_distance_u) + (py * pixel_distance_v);
     }
     Point3 defocusDiskSample() const
     {
         // Returns a random point in the camera defocus disk.
-        auto p = randomInUnitDisk();
+        double u1, u2;
+        sampler->get2D(u1, u2);
+        auto p = sampleUnitDisk(u1, u2);
         return camera_center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 };
\ No newline at end of file
@@ -0,0 +1,270 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include "hittable.h"
+#include "lights.h"
+#include "material_table.h"
+#include "parallel.h"
+#include "sampler.h"
+#include "stats.h"
+#include "trace.h"
+
+// Caustics by photon mapping: light reaching a diffuse surface through glass or off metal.
+// Camera paths only find that light when a bounce off the diffuse surface happens to pass through the glass and on
+// into a light, which for a small light is almost never. Instead photons are shot from the lights, followed through
+// specular bounces and kept where they land on a diffuse surface. Camera paths estimate the caustic from the photons
+// around their diffuse hits (density estimation) and stop counting light they find along that same route.
+// Photons sit in a hashed grid with cells twice the gather radius, sorted by bucket, so a lookup reads at most
+// eight short contiguous runs. One map with a fixed radius blurs the caustic, so the camera renders in passes with a
+// fresh map and a smaller radius each time (progressive photon mapping): the average over passes converges.
+class CausticMap
+{
+public:
+    // compact, the map holds a lot of them
+    struct Photon
+    {
+        float position[3];
+        float direction[3]; // travel direction, unit
+        float power[3];
+    };
+
+    // radius for the pass after iteration, r_{i+1}^2 = r_i^2 (i + alpha) / (i + 1). alpha in (0, 1) trades how fast
+    // the blur goes for noise
+    static double shrinkRadius(double radius, int iteration, double alpha = 2.0 / 3.0)
+    {
+        return radius * sqrt((iteration + alpha) / (iteration + 1));
+    }
+
+    // shoots photon_count photons from the emitters of world, in parallel. iteration decorrelates passes
+    void build(const Hittable &world, const MaterialTable &materials, const Sampler &prototype, int photon_count,
+               double _radius, int max_depth, int iteration)
+    {
+        TraceScope scope("photon map");
+        radius = _radius;
+        photons.clear();
+        bucket_start.clear();
+        sources.clear();
+        emitters.build(world, LIGHTS_POWER);
+        for (int k = 0; k < emitters.size(); k++)
+        {
+            hit_info probe;
+            if (emitters.light(k).shape->samplePoint(0, 0.5, 0.5, probe))
+            {
+                sources.insert(emitters.light(k).shape);
+            }
+        }
+        if (sources.empty() || photon_count <= 0 || !(radius > 0))
+        {
+            return;
+        }
+
+        const int chunk = 4096;
+        int chunks = (photon_count + chunk - 1) / chunk;
+        std::vector<std::vector<Photon>> found(chunks);
+        parallelFor(chunks, [&](int c)
+                    {
+            TraceScope scope("photons", "tile");
+            auto sampler = prototype.clone();
+            int end = std::min(photon_count, (c + 1) * chunk);
+            for (int k = c * chunk; k < end; k++)
+            {
+                sampler->startPixelSample(iteration, -1, k);
+                tracePhoton(world, materials, *sampler, photon_count, max_depth, found[c]);
+            } });
+        for (auto &part : found)
+        {
+            photons.insert(photons.end(), part.begin(), part.end());
+        }
+        sortIntoGrid();
+    }
+
+    size_t size() const { return photons.size(); }
+    double gatherRadius() const { return radius; }
+    // whether light from object reaches the map, paths running into it through glass are already counted by it.
+    // emitters that cannot place a point on themselves shoot nothing and are left to the camera paths
+    bool emitsPhotons(const Hittable *object) const { return sources.count(object) > 0; }
+
+    // calls visit on every photon within the gather radius of p
+    template <typename Visit>
+    void gather(const Point3 &p, Visit visit) const
+    {
+        if (photons.empty())
+        {
+            return;
+        }
+        int64_t lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = cellOf(p[a] - radius);
+            hi[a] = cellOf(p[a] + radius);
+        }
+        // cells are twice the radius wide, so at most two per axis. different cells can share a bucket, each bucket
+        // is read once
+        uint32_t seen[8];
+        int seen_count = 0;
+        auto radius_sqr = radius * radius;
+        for (auto x = lo[0]; x <= hi[0]; x++)
+        {
+            for (auto y = lo[1]; y <= hi[1]; y++)
+            {
+                for (auto z = lo[2]; z <= hi[2]; z++)
+                {
+                    auto bucket = bucketOf(x, y, z);
+                    bool again = false;
+                    for (int s = 0; s < seen_count; s++)
+                    {
+                        again = again || seen[s] == bucket;
+                    }
+                    if (again)
+                    {
+                        continue;
+                    }
+                    seen[seen_count++] = bucket;
+                    for (auto k = bucket_start[bucket]; k < bucket_start[bucket + 1]; k++)
+                    {
+                        const auto &photon = photons[k];
+                        auto dx = photon.position[0] - p[0];
+                        auto dy = photon.position[1] - p[1];
+                        auto dz = photon.position[2] - p[2];
+                        if (dx * dx + dy * dy + dz * dz <= radius_sqr)
+                        {
+                            visit(photon);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    LightSet emitters;
+    std::unordered_set<const Hittable *> sources;
+    std::vector<Photon> photons;         // ordered by bucket
+    std::vector<uint32_t> bucket_start;  // photons of bucket b are [bucket_start[b], bucket_start[b + 1])
+    uint32_t bucket_mask = 0;
+    double radius = 0;
+
+    int64_t cellOf(double x) const { return static_cast<int64_t>(std::floor(x / (2 * radius))); }
+    uint32_t bucketOf(int64_t x, int64_t y, int64_t z) const
+    {
+        auto h = static_cast<uint32_t>(x) * 73856093U ^ static_cast<uint32_t>(y) * 19349663U ^ static_cast<uint32_t>(z) * 83492791U;
+        return Sampler::hash(h) & bucket_mask;
+    }
+
+    // one photon: a light picked by power, a point on it, a cosine weighted direction off either side, then specular
+    // bounces until the first diffuse hit. only photons that went through at least one specular bounce are kept
+    void tracePhoton(const Hittable &world, const MaterialTable &materials, Sampler &sampler, int photon_count,
+                     int max_depth, std::vector<Photon> &out) const
+    {
+        double u1, u2, d1, d2;
+        sampler.setDimension(Sampler::pixel_dimension);
+        sampler.get2D(u1, u2);
+        sampler.get2D(d1, d2);
+        auto time = sampler.get1D();
+        sampler.startLightSample(0);
+        auto u = sampler.get1D();
+
+        int index;
+        double pmf;
+        hit_info source;
+        if (!emitters.pick(Point3(0, 0, 0), vec3(0, 0, 0), u, index, pmf) || pmf <= 0)
+        {
+            return;
+        }
+        const auto &shape = *emitters.light(index).shape;
+        if (!shape.samplePoint(time, u1, u2, source))
+        {
+            return;
+        }
+        // emitters shine from both sides, pick one
+        vec3 normal = source.normal;
+        if (d1 < 0.5)
+        {
+            normal = -normal;
+            d1 = 2 * d1;
+        }
+        else
+        {
+            d1 = 2 * d1 - 1;
+        }
+        // cosine weighted around the normal, so every photon carries L * area * pi (times 2 for the side) / pmf
+        auto r = sqrt(d1);
+        auto phi = 2 * pi * d2;
+        vec3 a = fabs(normal.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 t = normalize(normal.cross(a));
+        vec3 b = normal.cross(t);
+        vec3 direction = r * cos(phi) * t + r * sin(phi) * b + sqrt(fmax(0.0, 1 - d1)) * normal;
+        Color power = (2 * pi * shape.area() / (pmf * photon_count)) * materials.emitted(source);
+
+        Ray ray(source.p, direction, time);
+        bool specular = false;
+        for (int bounce = 0; bounce < max_depth; bounce++)
+        {
+            hit_info info;
+            RT_STAT(STAT_PHOTON_RAYS);
+            if (!world.hit(ray, Interval(0.001, infinity), info))
+            {
+                return;
+            }
+            Color attenuation;
+            Ray scattered;
+            sampler.startBounce(bounce);
+            if (!materials.scatter(ray, info, attenuation, scattered, sampler))
+            {
+                return;
+            }
+            if (materials.scatteringPdf(ray, info, scattered) > 0)
+            {
+                // first diffuse hit, the end of the caustic path either way
+                if (specular && !materials.isVolumetric(info))
+                {
+                    auto d = normalize(ray.direction());
+                    out.push_back(Photon{{float(info.p.x()), float(info.p.y()), float(info.p.z())},
+                                         {float(d.x()), float(d.y()), float(d.z())},
+                                         {float(power.x()), float(power.y()), float(power.z())}});
+                }
+                return;
+            }
+            specular = true;
+            power = power * attenuation;
+            ray = scattered;
+        }
+    }
+
+    // counting sort by bucket, with twice as many buckets as photons so most runs hold one cell
+    void sortIntoGrid()
+    {
+        if (photons.empty())
+        {
+            return;
+        }
+        uint32_t buckets = 1;
+        while (buckets < 2 * photons.size() && buckets < (1U << 30))
+        {
+            buckets <<= 1;
+        }
+        bucket_mask = buckets - 1;
+        bucket_start.assign(static_cast<size_t>(buckets) + 1, 0);
+        std::vector<uint32_t> keys(photons.size());
+        for (size_t k = 0; k < photons.size(); k++)
+        {
+            const auto &p = photons[k].position;
+            keys[k] = bucketOf(cellOf(p[0]), cellOf(p[1]), cellOf(p[2]));
+            bucket_start[keys[k] + 1]++;
+        }
+        for (uint32_t b = 0; b < buckets; b++)
+        {
+            bucket_start[b + 1] += bucket_start[b];
+        }
+        std::vector<Photon> sorted(photons.size());
+        std::vector<uint32_t> next(bucket_start.begin(), bucket_start.end() - 1);
+        for (size_t k = 0; k < photons.size(); k++)
+        {
+            sorted[next[keys[k]]++] = photons[k];
+        }
+        photons.swap(sorted);
+    }
+};
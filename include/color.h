@@ -8,7 +8,15 @@
 
 using Color = vec3;
 
-void writeColor(std::ostream &out, Color pixel_color, int samples_per_pixel)
+// one linear channel as its output byte, gamma 2
+inline int colorByte(double linear)
+{
+    // to clamp values bw 0.0 to 1.0
+    static Interval intensity(0.000, 0.999);
+    return static_cast<int>(256 * intensity.clamp(linearToGamma(linear)));
+}
+
+void writeColor(std::ostream &out, const Color &pixel_color, int samples_per_pixel)
 {
     // pixel_color comes from getRay
     auto r = pixel_color.x();
@@ -21,14 +29,5 @@ void writeColor(std::ostream &out, Color pixel_color, int samples_per_pixel)
     g *= scale;
     b *= scale;
 
-    //convert with gamma 2
-    r = linearToGamma(r);
-    g = linearToGamma(g);
-    b = linearToGamma(b);
-
-    // to clamp values bw 0.0 to 1.0
-    static Interval intensity(0.000, 0.999);
-    out << static_cast<int>(256 * intensity.clamp(r)) << ' '
-        << static_cast<int>(256 * intensity.clamp(g)) << ' '
-        << static_cast<int>(256 * intensity.clamp(b)) << '\n';
+    out << colorByte(r) << ' ' << colorByte(g) << ' ' << colorByte(b) << '\n';
 }
\ No newline at end of file
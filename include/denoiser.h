@@ -0,0 +1,172 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "fast_math.h"
+#include "parallel.h"
+#include "render_buffers.h"
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010), with the variance guided color weight from SVGF.
+// Each pass is a 5x5 B3 spline blur whose taps spread out twice as far as the last pass's, so a few cheap passes
+// cover a wide footprint. Every tap is weighted down when the guide buffers say it is across an edge: different
+// normal, depth or albedo, or a color difference larger than the pixel's own noise explains.
+// Texture detail is kept by filtering irradiance (color divided by albedo) and multiplying the albedo back after.
+class Denoiser
+{
+public:
+    int iterations = 5;
+    double sigma_color = 4.0;   // color differences are measured in standard deviations of the pixel's noise
+    double sigma_normal = 64.0; // exponent on the normal dot product
+    double sigma_depth = 0.05;  // relative depth difference
+    double sigma_albedo = 0.1;
+    int tile_size = 32;
+
+    void denoise(RenderBuffers &buffers) const
+    {
+        int w = buffers.width, h = buffers.height;
+        size_t n = buffers.color.size();
+        std::vector<Color> irradiance(n), next(n);
+        std::vector<double> variance = buffers.variance, next_variance(n);
+        for (size_t k = 0; k < n; k++)
+        {
+            irradiance[k] = demodulate(buffers.color[k], buffers.albedo[k]);
+            variance[k] = variance[k] / fmax(1e-4, luminance(buffers.albedo[k]) * luminance(buffers.albedo[k]));
+        }
+        // at low sample counts many pixels saw the same value every sample (all black, say) and report no variance,
+        // which would stop them from ever blending. the spread of their neighbourhood is a safer floor
+        std::vector<double> spatial(n);
+        parallelFor(h, [&](int j)
+                    {
+            for (int i = 0; i < w; i++)
+            {
+                spatial[buffers.index(i, j)] = spatialVariance(buffers, irradiance, i, j);
+            } });
+        for (size_t k = 0; k < n; k++)
+        {
+            variance[k] = fmax(variance[k], spatial[k]);
+        }
+
+        int tiles_x = (w + tile_size - 1) / tile_size;
+        int tiles_y = (h + tile_size - 1) / tile_size;
+        for (int it = 0; it < iterations; it++)
+        {
+            int step = 1 << it;
+            parallelFor(tiles_x * tiles_y, [&](int tile)
+                        {
+                int x0 = (tile % tiles_x) * tile_size, y0 = (tile / tiles_x) * tile_size;
+                int x1 = std::min(x0 + tile_size, w), y1 = std::min(y0 + tile_size, h);
+                for (int j = y0; j < y1; j++)
+                {
+                    for (int i = x0; i < x1; i++)
+                    {
+                        filterPixel(buffers, irradiance, variance, i, j, step, next, next_variance);
+                    }
+                } });
+            std::swap(irradiance, next);
+            std::swap(variance, next_variance);
+        }
+        for (size_t k = 0; k < n; k++)
+        {
+            buffers.color[k] = remodulate(irradiance[k], buffers.albedo[k]);
+            buffers.variance[k] = variance[k];
+        }
+    }
+
+private:
+    static Color demodulate(const Color &c, const Color &albedo)
+    {
+        return Color(c.x() / fmax(albedo.x(), 1e-3), c.y() / fmax(albedo.y(), 1e-3), c.z() / fmax(albedo.z(), 1e-3));
+    }
+    static Color remodulate(const Color &c, const Color &albedo)
+    {
+        return Color(c.x() * fmax(albedo.x(), 1e-3), c.y() * fmax(albedo.y(), 1e-3), c.z() * fmax(albedo.z(), 1e-3));
+    }
+
+    static double spatialVariance(const RenderBuffers &b, const std::vector<Color> &irradiance, int i, int j)
+    {
+        double sum = 0, sqr_sum = 0;
+        int count = 0;
+        for (int y = std::max(j - 2, 0); y <= std::min(j + 2, b.height - 1); y++)
+        {
+            for (int x = std::max(i - 2, 0); x <= std::min(i + 2, b.width - 1); x++)
+            {
+                auto lum = luminance(irradiance[b.index(x, y)]);
+                sum += lum;
+                sqr_sum += lum * lum;
+                count++;
+            }
+        }
+        auto mean = sum / count;
+        return fmax(0.0, sqr_sum / count - mean * mean);
+    }
+
+    static double blurredVariance(const RenderBuffers &b, const std::vector<double> &variance, int i, int j)
+    {
+        static const double kernel[2] = {1.0 / 4.0, 1.0 / 8.0};
+        double sum = 0, weight_sum = 0;
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            for (int dx = -1; dx <= 1; dx++)
+            {
+                int x = i + dx, y = j + dy;
+                if (x < 0 || x >= b.width || y < 0 || y >= b.height)
+                    continue;
+                double w = kernel[abs(dx)] * kernel[abs(dy)];
+                sum += w * variance[b.index(x, y)];
+                weight_sum += w;
+            }
+        }
+        return sum / weight_sum;
+    }
+
+    void filterPixel(const RenderBuffers &b, const std::vector<Color> &in, const std::vector<double> &in_variance,
+                     int i, int j, int step, std::vector<Color> &out, std::vector<double> &out_variance) const
+    {
+        static const double kernel[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+        int p = b.index(i, j);
+        auto lum_p = luminance(in[p]);
+        // a single pixel's variance estimate is itself noisy (often zero at low sample counts), blur it a little first
+        auto color_scale = sigma_color * sqrt(fmax(blurredVariance(b, in_variance, i, j), 0.0)) + 1e-4;
+        auto n_p = b.normal[p];
+        bool escaped_p = n_p.sqrLength() == 0;
+
+        Color sum(0, 0, 0);
+        double weight_sum = 0, variance_sum = 0;
+        for (int dy = -2; dy <= 2; dy++)
+        {
+            int y = j + dy * step;
+            if (y < 0 || y >= b.height)
+                continue;
+            for (int dx = -2; dx <= 2; dx++)
+            {
+                int x = i + dx * step;
+                if (x < 0 || x >= b.width)
+                    continue;
+                int q = b.index(x, y);
+                auto n_q = b.normal[q];
+                bool escaped_q = n_q.sqrLength() == 0;
+                // escaped rays only blend with other escaped rays
+                if (escaped_p != escaped_q)
+                    continue;
+
+                double w = kernel[abs(dx)] * kernel[abs(dy)];
+                if (!escaped_p)
+                {
+                    w *= rtPow(fmax(0.0, n_p.dot(n_q)), sigma_normal);
+                    auto depth_scale = sigma_depth * b.depth[p] * step + 1e-6;
+                    w *= rtExp(-fabs(b.depth[p] - b.depth[q]) / depth_scale);
+                }
+                auto albedo_diff = b.albedo[p] - b.albedo[q];
+                w *= rtExp(-albedo_diff.sqrLength() / (sigma_albedo * sigma_albedo));
+                w *= rtExp(-fabs(lum_p - luminance(in[q])) / color_scale);
+
+                sum += w * in[q];
+                weight_sum += w;
+                variance_sum += w * w * in_variance[q];
+            }
+        }
+        // the center tap always has weight, so weight_sum is never zero
+        out[p] = sum / weight_sum;
+        out_variance[p] = variance_sum / (weight_sum * weight_sum);
+    }
+};
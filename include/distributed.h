@@ -0,0 +1,295 @@
+#pragma once
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Renders an image tile by tile in worker processes on this machine.
+// The coordinator forks the workers, so each one starts with the scene and the camera state exactly as they are in
+// the coordinator (copy on write, nothing is loaded or sent twice), and talks to each over its own socket pair.
+// Every idle worker gets the next tile, and answers with the tile echoed back followed by its pixels as floats, which
+// the coordinator merges. A worker that dies or answers garbage is dropped and its tile goes back in the queue for
+// the others. Once no worker is left the coordinator renders what remains itself.
+// With tracing on (trace.h) every tile shows as a span on its worker's row, from being sent out to being merged.
+
+// whole buffer socket io, false on an error or the end of the stream. MSG_NOSIGNAL so writing to a dead peer is
+// an error instead of a SIGPIPE
+inline bool sendAll(int fd, const void *data, size_t size)
+{
+    auto bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        auto sent = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return false;
+        }
+        bytes += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+inline bool receiveAll(int fd, void *data, size_t size)
+{
+    auto bytes = static_cast<char *>(data);
+    while (size > 0)
+    {
+        auto got = recv(fd, bytes, size, 0);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return false;
+        }
+        bytes += got;
+        size -= static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// pixels [x0, x1) x [y0, y1), x0 below zero tells a worker to stop
+struct Tile
+{
+    int32_t x0, y0, x1, y1;
+
+    size_t pixelCount() const { return static_cast<size_t>(x1 - x0) * (y1 - y0); }
+    bool operator==(const Tile &other) const { return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 && y1 == other.y1; }
+};
+
+class TileFarm
+{
+public:
+    // splits area into tiles. render(tile, values) fills values with values_per_pixel floats per pixel of the tile,
+    // row by row. it runs in the workers, or in the coordinator for tiles no worker is left for. merge(tile, values)
+    // takes them in
+    template <typename Render, typename Merge>
+    void run(const Tile &area, int tile_size, int worker_count, int values_per_pixel, Render render, Merge merge, bool progress)
+    {
+        std::deque<Tile> queue;
+        for (int y = area.y0; y < area.y1; y += tile_size)
+        {
+            for (int x = area.x0; x < area.x1; x += tile_size)
+            {
+                queue.push_back(Tile{x, y, std::min(x + tile_size, area.x1), std::min(y + tile_size, area.y1)});
+            }
+        }
+        auto remaining = queue.size();
+        startWorkers(worker_count, values_per_pixel, render);
+
+        std::vector<float> values;
+        std::vector<pollfd> polls;
+        std::vector<size_t> polled;
+        while (remaining > 0)
+        {
+            if (progress)
+            {
+                std::clog << "\rTiles remaining " << remaining << "      " << std::flush;
+            }
+            for (size_t w = 0; w < workers.size(); w++)
+            {
+                auto &worker = workers[w];
+                if (worker.fd >= 0 && !worker.busy && !queue.empty())
+                {
+                    worker.tile = queue.front();
+                    queue.pop_front();
+                    worker.busy = true;
+                    worker.sent = Tracer::instance().now();
+                    if (!sendAll(worker.fd, &worker.tile, sizeof(Tile)))
+                    {
+                        retire(w, queue);
+                    }
+                }
+            }
+            polls.clear();
+            polled.clear();
+            for (size_t w = 0; w < workers.size(); w++)
+            {
+                if (workers[w].fd >= 0 && workers[w].busy)
+                {
+                    polls.push_back(pollfd{workers[w].fd, POLLIN, 0});
+                    polled.push_back(w);
+                }
+            }
+            if (polls.empty())
+            {
+                // no worker left
+                break;
+            }
+            if (poll(polls.data(), polls.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // the tiles out with the workers are rendered here instead, along with the rest of the queue
+                for (auto &worker : workers)
+                {
+                    if (worker.busy)
+                    {
+                        queue.push_front(worker.tile);
+                        worker.busy = false;
+                    }
+                }
+                break;
+            }
+            for (size_t p = 0; p < polls.size(); p++)
+            {
+                if (polls[p].revents == 0)
+                {
+                    continue;
+                }
+                auto w = polled[p];
+                auto &worker = workers[w];
+                Tile echo;
+                values.resize(worker.tile.pixelCount() * values_per_pixel);
+                if (!receiveAll(worker.fd, &echo, sizeof(Tile)) || !(echo == worker.tile) ||
+                    !receiveAll(worker.fd, values.data(), values.size() * sizeof(float)))
+                {
+                    retire(w, queue);
+                    continue;
+                }
+                merge(worker.tile, values);
+                Tracer::instance().record("tile", "tile", worker.sent, Tracer::instance().now(), worker.pid, 1);
+                worker.busy = false;
+                remaining--;
+            }
+        }
+
+        // whatever the workers did not get to
+        while (!queue.empty())
+        {
+            if (progress)
+            {
+                std::clog << "\rTiles remaining " << queue.size() << "      " << std::flush;
+            }
+            auto tile = queue.front();
+            queue.pop_front();
+            TraceScope scope("tile", "tile");
+            values.assign(tile.pixelCount() * values_per_pixel, 0);
+            render(tile, values);
+            merge(tile, values);
+        }
+        stopWorkers();
+    }
+
+    // workers that failed during the last run
+    int failures() const { return failed; }
+
+private:
+    struct Worker
+    {
+        pid_t pid;
+        int fd; // below zero once the worker is gone
+        bool busy;
+        Tile tile;
+        double sent; // trace time the tile went out
+    };
+    std::vector<Worker> workers;
+    int failed = 0;
+
+    template <typename Render>
+    void startWorkers(int count, int values_per_pixel, Render &render)
+    {
+        workers.clear();
+        failed = 0;
+        for (int w = 0; w < count; w++)
+        {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+            {
+                break;
+            }
+            pid_t pid = fork();
+            if (pid < 0)
+            {
+                close(fds[0]);
+                close(fds[1]);
+                break;
+            }
+            if (pid == 0)
+            {
+                close(fds[0]);
+                // the other workers' sockets came along with the fork, they would keep those workers from seeing
+                // the coordinator go away
+                for (const auto &other : workers)
+                {
+                    close(other.fd);
+                }
+                workerLoop(fds[1], values_per_pixel, render);
+            }
+            close(fds[1]);
+            workers.push_back(Worker{pid, fds[0], false, Tile{0, 0, 0, 0}, 0});
+            Tracer::instance().nameProcess(pid, "worker " + std::to_string(pid));
+        }
+        if (workers.empty() && count > 0)
+        {
+            std::clog << "\rCould not start workers, rendering in this process\n";
+        }
+    }
+
+    template <typename Render>
+    [[noreturn]] static void workerLoop(int fd, int values_per_pixel, Render &render)
+    {
+        Tile tile;
+        std::vector<float> values;
+        while (receiveAll(fd, &tile, sizeof(Tile)) && tile.x0 >= 0)
+        {
+            values.assign(tile.pixelCount() * values_per_pixel, 0);
+            render(tile, values);
+            if (!sendAll(fd, &tile, sizeof(Tile)) || !sendAll(fd, values.data(), values.size() * sizeof(float)))
+            {
+                break;
+            }
+        }
+        // skips the coordinator's atexit handlers and stream buffers that came along with the fork
+        _exit(0);
+    }
+
+    void retire(size_t w, std::deque<Tile> &queue)
+    {
+        auto &worker = workers[w];
+        std::clog << "\rWorker " << worker.pid << " failed, its tile goes to another\n";
+        close(worker.fd);
+        worker.fd = -1;
+        kill(worker.pid, SIGKILL);
+        waitpid(worker.pid, nullptr, 0);
+        if (worker.busy)
+        {
+            queue.push_front(worker.tile);
+            worker.busy = false;
+        }
+        failed++;
+    }
+
+    void stopWorkers()
+    {
+        Tile stop{-1, -1, -1, -1};
+        for (auto &worker : workers)
+        {
+            if (worker.fd >= 0)
+            {
+                sendAll(worker.fd, &stop, sizeof(Tile));
+                close(worker.fd);
+                worker.fd = -1;
+                waitpid(worker.pid, nullptr, 0);
+            }
+        }
+        workers.clear();
+    }
+};
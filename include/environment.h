@@ -0,0 +1,132 @@
+#pragma once
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "alias_table.h"
+#include "color.h"
+#include "fast_math.h"
+#include "image.h"
+#include "render_buffers.h"
+#include "utilities.h"
+#include "vec3.h"
+
+// Light arriving from infinitely far away in every direction, stored as a lat-long (equirectangular) image:
+// columns go around the vertical axis, rows from straight up (top) to straight down, the same angles sphere uvs use.
+// Escaped rays read one pixel. For light sampling every pixel gets a probability proportional to its luminance times
+// the solid angle it covers (rows near the poles are squeezed), held in an alias table, so a small bright sun is found
+// by almost every light sample instead of almost never.
+class EnvironmentLight
+{
+public:
+    EnvironmentLight(const char *filename, double intensity = 1.0)
+    {
+        HdrImage image(filename);
+        std::vector<Color> values(static_cast<size_t>(image.width()) * image.height());
+        for (int j = 0; j < image.height(); j++)
+        {
+            for (int i = 0; i < image.width(); i++)
+            {
+                auto pixel = image.pixelData(i, j);
+                values[static_cast<size_t>(j) * image.width() + i] = intensity * Color(pixel[0], pixel[1], pixel[2]);
+            }
+        }
+        build(image.width(), image.height(), std::move(values));
+    }
+    // from linear radiance values, row major starting at the top row
+    EnvironmentLight(int _width, int _height, std::vector<Color> values) { build(_width, _height, std::move(values)); }
+
+    bool valid() const { return width > 0 && height > 0; }
+    int imageWidth() const { return width; }
+    int imageHeight() const { return height; }
+
+    // radiance arriving along -direction, i.e. seen looking along direction
+    Color value(const vec3 &direction) const
+    {
+        if (!valid())
+        {
+            return Color(0, 0, 0);
+        }
+        double u, v;
+        directionToUV(direction, u, v);
+        return pixels[pixelIndex(u, v)];
+    }
+
+    // direction towards the environment, (u, u1, u2) uniform in [0, 1). false when nothing in it emits
+    bool sample(double u, double u1, double u2, vec3 &direction, double &pdf) const
+    {
+        if (distribution.size() == 0)
+        {
+            return false;
+        }
+        double pmf;
+        int index = distribution.sample(u, pmf);
+        auto theta = pi * ((index / width) + u2) / height;
+        auto phi = 2 * pi * ((index % width) + u1) / width;
+        auto sin_theta = sin(theta);
+        direction = vec3(-sin_theta * cos(phi), cos(theta), sin_theta * sin(phi));
+        pdf = sin_theta > 0 ? pmf * width * height / (2 * pi * pi * sin_theta) : 0;
+        return pdf > 0;
+    }
+    // density (over solid angle) of sample picking direction
+    double pdfValue(const vec3 &direction) const
+    {
+        if (distribution.size() == 0)
+        {
+            return 0;
+        }
+        double u, v;
+        vec3 d = normalize(direction);
+        directionToUV(d, u, v);
+        auto sin_theta = sqrt(fmax(0.0, 1 - d.y() * d.y()));
+        if (sin_theta <= 0)
+        {
+            return 0;
+        }
+        return distribution.pmf(pixelIndex(u, v)) * width * height / (2 * pi * pi * sin_theta);
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<Color> pixels;
+    AliasTable distribution;
+
+    void build(int _width, int _height, std::vector<Color> values)
+    {
+        width = _width;
+        height = _height;
+        pixels = std::move(values);
+        if (!valid())
+        {
+            return;
+        }
+        std::vector<double> weights(pixels.size());
+        for (int j = 0; j < height; j++)
+        {
+            auto sin_theta = sin(pi * (j + 0.5) / height);
+            for (int i = 0; i < width; i++)
+            {
+                auto index = static_cast<size_t>(j) * width + i;
+                weights[index] = fmax(0.0, luminance(pixels[index])) * sin_theta;
+            }
+        }
+        distribution.build(weights);
+    }
+
+    // same angles as sphere uvs, but v runs from the top row down
+    static void directionToUV(vec3 direction, double &u, double &v)
+    {
+        auto length = direction.length();
+        auto y = Interval(-1, 1).clamp(direction.y() / length);
+        u = (rtAtan2(-direction.z(), direction.x()) + pi) / (2 * pi);
+        v = rtAcos(y) / pi;
+    }
+    int pixelIndex(double u, double v) const
+    {
+        auto i = static_cast<int>(u * width);
+        auto j = static_cast<int>(v * height);
+        i = i < 0 ? 0 : (i >= width ? width - 1 : i);
+        j = j < 0 ? 0 : (j >= height ? height - 1 : j);
+        return j * width + i;
+    }
+};
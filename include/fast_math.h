@@ -0,0 +1,117 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include "utilities.h"
+
+// Approximations of the libm calls on the hot paths: atan2 and acos for sphere and environment uv, log for free flight
+// distances in media, and exp and pow in the denoiser's weights. All are plain polynomials with no tables and no
+// branches past a select, so a loop over them vectorizes, which libm's calls do not.
+// Compiled in with RT_FAST_MATH defined (cmake -DRAYCASTER_FAST_MATH=ON), the rt* functions below then use them,
+// otherwise they are the libm calls and nothing changes. bench/math_check.cpp bounds their error:
+//   fastAtan2, fastAcos   within 4e-8 radians (minimax polynomials fit for this file)
+//   fastLog               within 1e-12 absolute for positive normal numbers, -infinity at 0
+//   fastExp               within 1e-9 relative, 0 below -708 and infinity above 709
+// The output gamma is left to sqrt, which is a single instruction once -fno-math-errno lets it inline.
+
+// atan on [0, 1], odd minimax polynomial
+inline double fastAtanUnit(double x)
+{
+    auto x2 = x * x;
+    return x * (0.9999993350334074 +
+                x2 * (-0.33329858678906726 +
+                      x2 * (0.1994654247328748 +
+                            x2 * (-0.13908517758075153 +
+                                  x2 * (0.09641921505280308 +
+                                        x2 * (-0.0559086901913888 +
+                                              x2 * (0.02186051975671537 + x2 * -0.004053914051789657)))))));
+}
+
+inline double fastAtan2(double y, double x)
+{
+    auto ax = std::fabs(x), ay = std::fabs(y);
+    auto swap = ay > ax;
+    auto small = swap ? ax : ay, big = swap ? ay : ax;
+    // divides either way, a division under a condition could trap and keeps the loop from vectorizing
+    auto r = fastAtanUnit(small / (big > 0 ? big : 1));
+    r = swap ? pi / 2 - r : r;
+    r = x < 0 ? pi - r : r;
+    return std::copysign(r, y);
+}
+
+// acos(x) = sqrt(1 - x) * polynomial on [0, 1], and pi - acos(-x) below 0
+inline double fastAcos(double x)
+{
+    auto a = std::fabs(x);
+    a = a < 1 ? a : 1;
+    auto r = std::sqrt(1 - a) *
+             (1.5707963143153314 +
+              a * (-0.21459989211563751 +
+                   a * (0.0889992597127463 +
+                        a * (-0.050312753303702454 +
+                             a * (0.03133537957917713 +
+                                  a * (-0.017808847494583748 + a * (0.007245345470426901 + a * -0.001441449574096477)))))));
+    return x < 0 ? pi - r : r;
+}
+
+// x = m * 2^e with m in [sqrt(1/2), sqrt(2)), then log(m) = 2 atanh((m - 1) / (m + 1)) as a short series
+inline double fastLog(double x)
+{
+    // -infinity at 0 and nan below, added on at the end, selected up front as in fastExp
+    auto edge = x > 0 ? 0 : (x == 0 ? -infinity : std::numeric_limits<double>::quiet_NaN());
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    // the exponent converted through a double's mantissa, 2^52 + e + 1023, as there is no vector int64 conversion
+    auto exponent_bits = (bits >> 52) | 0x4330000000000000ULL;
+    double e;
+    std::memcpy(&e, &exponent_bits, sizeof(e));
+    e -= 4503599627370496.0 + 1023;
+    bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+    auto high = m > 1.4142135623730951;
+    m = high ? 0.5 * m : m;
+    e = high ? e + 1 : e;
+    auto s = (m - 1) / (m + 1), s2 = s * s;
+    auto series = 1 + s2 * (1.0 / 3 + s2 * (1.0 / 5 + s2 * (1.0 / 7 + s2 * (1.0 / 9 + s2 * (1.0 / 11 + s2 * (1.0 / 13))))));
+    return e * 0.6931471805599453 + 2 * s * series + edge;
+}
+
+// e^x = 2^k e^r with |r| <= ln 2 / 2, e^r as its Taylor series
+inline double fastExp(double x)
+{
+    // what is left of e^x outside the clamped range, 0 or infinity (or nan), 1 inside it. selected up front, gcc
+    // will not vectorize a select after the bit casts below
+    auto edge = x < -708 ? 0 : (x > 709 ? infinity : (x == x ? 1 : x));
+    auto c = x > -708 ? (x < 709 ? x : 709) : -708;
+    // rounded to the nearest integer by pushing the fraction out of the mantissa, whose low bits then hold k
+    auto shifted = c * 1.4426950408889634 + 6755399441055744.0;
+    auto k = shifted - 6755399441055744.0;
+    // ln 2 in two parts, so r keeps its low bits
+    auto r = (c - k * 0.6931471803691238) - k * 1.9082149292705877e-10;
+    auto p = 1 + r * (1 + r * (1.0 / 2 + r * (1.0 / 6 + r * (1.0 / 24 + r * (1.0 / 120 + r * (1.0 / 720 + r * (1.0 / 5040 + r * (1.0 / 40320))))))));
+    uint64_t bits;
+    std::memcpy(&bits, &shifted, sizeof(bits));
+    bits = (bits + 1023) << 52;
+    double scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p * scale * edge;
+}
+
+// x^y for x >= 0 and y > 0
+inline double fastPow(double x, double y) { return fastExp(y * fastLog(x)); }
+
+#ifdef RT_FAST_MATH
+inline double rtAtan2(double y, double x) { return fastAtan2(y, x); }
+inline double rtAcos(double x) { return fastAcos(x); }
+inline double rtLog(double x) { return fastLog(x); }
+inline double rtExp(double x) { return fastExp(x); }
+inline double rtPow(double x, double y) { return fastPow(x, y); }
+#else
+inline double rtAtan2(double y, double x) { return std::atan2(y, x); }
+inline double rtAcos(double x) { return std::acos(x); }
+inline double rtLog(double x) { return std::log(x); }
+inline double rtExp(double x) { return std::exp(x); }
+inline double rtPow(double x, double y) { return std::pow(x, y); }
+#endif
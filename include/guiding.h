@@ -0,0 +1,391 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "aabb.h"
+#include "fast_math.h"
+#include "interval.h"
+#include "utilities.h"
+#include "vec3.h"
+
+// lock free add for doubles, every render thread records into the same cells
+inline void atomicAdd(std::atomic<double> &target, double value)
+{
+    auto current = target.load(std::memory_order_relaxed);
+    while (!target.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+    {
+    }
+}
+
+// Where light arrives from at one region of space, as a quadtree over the unit square that directions map to by
+// (cos theta, phi). That map keeps areas, so a density on the square is a density over solid angle times 4 pi.
+// Two trees are kept: one to sample from, learned in the previous training pass and read only during a pass,
+// and one that records the current pass with atomic sums. Between passes the recorded one becomes the sampling one,
+// and its cells holding much of the light are split further for the next pass to record into.
+class DirectionalTree
+{
+public:
+    // subdivide cells holding more than this share of the light, up to max_depth levels
+    static constexpr double split_share = 0.03;
+    static const int max_depth = 20;
+
+    // shares of bounces following the guide that a region can settle on, share k is k / share_count
+    static const int share_count = 5;
+
+    explicit DirectionalTree(double _guiding_fraction = 0.5) : guiding_fraction(_guiding_fraction)
+    {
+        sampling_children.assign(1, Children{0, 0, 0, 0});
+        sampling_sums.assign(4, 0.0);
+        resetBuilding(sampling_children);
+        for (auto &moment : share_moments)
+        {
+            moment.store(0);
+        }
+    }
+    DirectionalTree(const DirectionalTree &other)
+        : guiding_fraction(other.guiding_fraction), sampling_children(other.sampling_children),
+          sampling_sums(other.sampling_sums), building_children(other.building_children),
+          building_sums(other.building_sums.size()), records(other.records.load())
+    {
+        for (size_t k = 0; k < building_sums.size(); k++)
+        {
+            building_sums[k].store(other.building_sums[k].load());
+        }
+        for (int k = 0; k < share_count; k++)
+        {
+            share_moments[k].store(other.share_moments[k].load());
+        }
+    }
+
+    static void toSquare(const vec3 &direction, double &x, double &y)
+    {
+        auto cos_theta = Interval(-1, 1).clamp(direction.z());
+        auto phi = rtAtan2(direction.y(), direction.x());
+        phi = phi < 0 ? phi + 2 * pi : phi;
+        x = (cos_theta + 1) / 2;
+        y = fmin(phi / (2 * pi), 1 - 1e-12);
+    }
+    static vec3 fromSquare(double x, double y)
+    {
+        auto cos_theta = 2 * x - 1;
+        auto sin_theta = sqrt(fmax(0.0, 1 - cos_theta * cos_theta));
+        auto phi = 2 * pi * y;
+        return vec3(sin_theta * cos(phi), sin_theta * sin(phi), cos_theta);
+    }
+
+    // unit direction, (u1, u2) uniform in [0, 1)
+    vec3 sample(double u1, double u2) const
+    {
+        int node = 0;
+        double x0 = 0, y0 = 0, size = 1;
+        while (true)
+        {
+            const double *s = &sampling_sums[4 * node];
+            auto total = s[0] + s[1] + s[2] + s[3];
+            if (total <= 0)
+            {
+                break;
+            }
+            // quadrant q is (q & 1) along x and (q >> 1) along y. pick the column first, then the row in it
+            int qx = pick(s[0] + s[2], s[1] + s[3], u1);
+            int qy = pick(s[qx], s[qx + 2], u2);
+            size /= 2;
+            x0 += qx * size;
+            y0 += qy * size;
+            int child = sampling_children[node][qx + 2 * qy];
+            if (child == 0)
+            {
+                break;
+            }
+            node = child;
+        }
+        return fromSquare(x0 + u1 * size, y0 + u2 * size);
+    }
+    // density over solid angle of sample returning direction
+    double pdf(const vec3 &direction) const
+    {
+        double x, y;
+        toSquare(direction, x, y);
+        int node = 0;
+        double density = 1;
+        while (true)
+        {
+            const double *s = &sampling_sums[4 * node];
+            auto total = s[0] + s[1] + s[2] + s[3];
+            if (total <= 0)
+            {
+                break;
+            }
+            int qx = x < 0.5 ? 0 : 1;
+            int qy = y < 0.5 ? 0 : 1;
+            density *= 4 * s[qx + 2 * qy] / total;
+            int child = sampling_children[node][qx + 2 * qy];
+            if (child == 0 || density == 0)
+            {
+                break;
+            }
+            x = 2 * x - qx;
+            y = 2 * y - qy;
+            node = child;
+        }
+        return density / (4 * pi);
+    }
+
+    // adds a radiance estimate (radiance over the density of the direction it came from) at direction
+    void record(const vec3 &direction, double value)
+    {
+        records.fetch_add(1, std::memory_order_relaxed);
+        if (!(value > 0) || !std::isfinite(value))
+        {
+            return;
+        }
+        double x, y;
+        toSquare(direction, x, y);
+        int node = 0;
+        while (true)
+        {
+            int qx = x < 0.5 ? 0 : 1;
+            int qy = y < 0.5 ? 0 : 1;
+            atomicAdd(building_sums[4 * node + qx + 2 * qy], value);
+            int child = building_children[node][qx + 2 * qy];
+            if (child == 0)
+            {
+                return;
+            }
+            x = 2 * x - qx;
+            y = 2 * y - qy;
+            node = child;
+        }
+    }
+    uint64_t recordCount() const { return records.load(std::memory_order_relaxed); }
+    void setRecordCount(uint64_t count) { records.store(count); }
+
+    // How often to follow the guide here rather than the material. Where light arrives evenly the material's cosine
+    // lobe is about as good as sampling gets and following the guide only costs, so every region learns its own share:
+    // each guided pass scores all the candidate shares on the samples it took, by the second moment each would have
+    // given (integrand over the mixed density), and refine keeps the lowest
+    double guidingFraction() const { return guiding_fraction; }
+    // integrand is the bounce's contribution before dividing by pdf, the density it was actually sampled with
+    void recordShares(double integrand, double guide_pdf, double material_pdf, double pdf)
+    {
+        if (!(integrand > 0) || !std::isfinite(integrand) || !(pdf > 0))
+        {
+            return;
+        }
+        for (int k = 0; k < share_count; k++)
+        {
+            auto share = static_cast<double>(k) / share_count;
+            auto mixed = share * guide_pdf + (1 - share) * material_pdf;
+            if (mixed > 0)
+            {
+                atomicAdd(share_moments[k], integrand * integrand / (mixed * pdf));
+            }
+        }
+    }
+
+    // end of a training pass: what was recorded becomes the distribution to sample, and recording starts over on a
+    // tree refined where that distribution holds the most light. a region that recorded nothing keeps what it had
+    void refine()
+    {
+        records.store(0);
+        int best = -1;
+        for (int k = 0; k < share_count; k++)
+        {
+            auto moment = share_moments[k].load();
+            if (moment > 0 && (best < 0 || moment < share_moments[best].load()))
+            {
+                best = k;
+            }
+        }
+        if (best >= 0)
+        {
+            guiding_fraction = static_cast<double>(best) / share_count;
+        }
+        for (auto &moment : share_moments)
+        {
+            moment.store(0);
+        }
+        std::vector<double> sums(building_sums.size());
+        double total = 0;
+        for (size_t k = 0; k < sums.size(); k++)
+        {
+            sums[k] = building_sums[k].load();
+        }
+        for (int q = 0; q < 4; q++)
+        {
+            total += sums[q];
+        }
+        if (total <= 0)
+        {
+            resetBuilding(building_children);
+            return;
+        }
+        sampling_children = building_children;
+        sampling_sums = sums;
+
+        std::vector<Children> refined;
+        refineNode(0, total, total, 1, refined);
+        resetBuilding(refined);
+    }
+
+    size_t nodeCount() const { return sampling_children.size(); }
+
+private:
+    // child node of each quadrant, 0 for a leaf quadrant (the root is never anyone's child)
+    typedef std::array<int, 4> Children;
+
+    double guiding_fraction;
+    std::array<std::atomic<double>, share_count> share_moments;
+    std::vector<Children> sampling_children;
+    std::vector<double> sampling_sums; // 4 per node
+    std::vector<Children> building_children;
+    std::vector<std::atomic<double>> building_sums;
+    std::atomic<uint64_t> records{0};
+
+    void resetBuilding(const std::vector<Children> &children)
+    {
+        building_children = children;
+        building_sums = std::vector<std::atomic<double>>(4 * children.size());
+        for (auto &sum : building_sums)
+        {
+            sum.store(0);
+        }
+    }
+
+    static int pick(double a, double b, double &u)
+    {
+        auto p = a + b > 0 ? a / (a + b) : 0.5;
+        if (u < p)
+        {
+            u = fmin(u / p, 1 - 1e-12);
+            return 0;
+        }
+        u = fmin((u - p) / (1 - p), 1 - 1e-12);
+        return 1;
+    }
+
+    // old_node < 0 means a cell that was a leaf in the recorded tree, its energy is taken as spread evenly
+    int refineNode(int old_node, double energy, double total, int depth, std::vector<Children> &out)
+    {
+        int id = static_cast<int>(out.size());
+        out.push_back(Children{0, 0, 0, 0});
+        for (int q = 0; q < 4; q++)
+        {
+            auto quadrant_energy = old_node >= 0 ? building_sums[4 * old_node + q].load() : energy / 4;
+            if (depth < max_depth && quadrant_energy / total > split_share)
+            {
+                int old_child = old_node >= 0 ? building_children[old_node][q] : 0;
+                int child = refineNode(old_child > 0 ? old_child : -1, quadrant_energy, total, depth + 1, out);
+                out[id][q] = child;
+            }
+        }
+        return id;
+    }
+};
+
+// Spatial half of the cache, a binary tree over the scene's bounds cut in half along x, y, z in turn, with a
+// DirectionalTree in each leaf. Leaves that recorded many samples in a pass are split, so the cache gets finer where
+// paths actually go. The tree only changes between passes, during a pass lookups are read only and recording is
+// lock free, so any number of render threads can share it.
+class GuidingCache
+{
+public:
+    // leaves recording more than spatial_threshold * sqrt(2^pass) samples in a pass are split
+    double spatial_threshold = 4000;
+
+    // guiding_fraction is the share every region starts with, before it learns its own
+    void reset(const AABB &scene_bounds, double guiding_fraction)
+    {
+        // a cube, so the alternating cuts keep cells roughly cubic
+        auto extent = fmax(scene_bounds.x.size(), fmax(scene_bounds.y.size(), scene_bounds.z.size()));
+        extent = std::isfinite(extent) && extent > 0 ? extent * 1.001 : 1;
+        Point3 center((scene_bounds.x.min + scene_bounds.x.max) / 2, (scene_bounds.y.min + scene_bounds.y.max) / 2,
+                      (scene_bounds.z.min + scene_bounds.z.max) / 2);
+        auto half = vec3(extent, extent, extent) / 2;
+        bounds = AABB(center - half, center + half);
+        nodes.assign(1, Node{0, {0, 0}, 0});
+        leaves.clear();
+        leaves.push_back(std::make_shared<DirectionalTree>(guiding_fraction));
+        trained = false;
+    }
+
+    DirectionalTree *find(const Point3 &p) const
+    {
+        Point3 lo(bounds.x.min, bounds.y.min, bounds.z.min);
+        Point3 size(bounds.x.size(), bounds.y.size(), bounds.z.size());
+        vec3 local;
+        for (int a = 0; a < 3; a++)
+        {
+            local[a] = Interval(0, 1 - 1e-12).clamp((p[a] - lo[a]) / size[a]);
+        }
+        int node = 0;
+        while (nodes[node].child[0] != 0)
+        {
+            int axis = nodes[node].axis;
+            int side = local[axis] < 0.5 ? 0 : 1;
+            local[axis] = 2 * local[axis] - side;
+            node = nodes[node].child[side];
+        }
+        return leaves[nodes[node].leaf].get();
+    }
+
+    // end of training pass number pass (from 0)
+    void refine(int pass)
+    {
+        auto threshold = spatial_threshold * sqrt(static_cast<double>(uint64_t(1) << pass));
+        // nodes grows while splitting, so go by index
+        for (size_t n = 0; n < nodes.size(); n++)
+        {
+            if (nodes[n].child[0] == 0)
+            {
+                split(static_cast<int>(n), threshold);
+            }
+        }
+        for (auto &leaf : leaves)
+        {
+            leaf->refine();
+        }
+        trained = true;
+    }
+
+    // false until the first pass has been learned, before that there is nothing worth sampling
+    bool isTrained() const { return trained; }
+    size_t leafCount() const { return leaves.size(); }
+
+private:
+    struct Node
+    {
+        int axis;
+        int child[2]; // 0 for leaves
+        int leaf;
+    };
+    AABB bounds;
+    std::vector<Node> nodes;
+    std::vector<std::shared_ptr<DirectionalTree>> leaves; // shared so cameras stay copyable, reset starts fresh ones
+    bool trained = false;
+
+    void split(int node, double threshold)
+    {
+        auto &tree = *leaves[nodes[node].leaf];
+        auto count = tree.recordCount();
+        if (count <= threshold || nodes.size() > (1u << 24))
+        {
+            return;
+        }
+        // both halves start from a copy of the parent's trees, each assumed to have seen half its samples
+        tree.setRecordCount(count / 2);
+        auto copy = std::make_shared<DirectionalTree>(tree);
+        int axis = nodes[node].axis;
+        int left = static_cast<int>(nodes.size());
+        nodes.push_back(Node{(axis + 1) % 3, {0, 0}, nodes[node].leaf});
+        nodes.push_back(Node{(axis + 1) % 3, {0, 0}, static_cast<int>(leaves.size())});
+        leaves.push_back(std::move(copy));
+        nodes[node].child[0] = left;
+        nodes[node].child[1] = left + 1;
+        split(left, threshold);
+        split(left + 1, threshold);
+    }
+};
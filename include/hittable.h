@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include "vec3.h"
 #include "ray.h"
@@ -7,13 +8,17 @@
 #include "interval.h"
 
 class Material;
+class Hittable;
 class hit_info
 {
 public:
     Point3 p;
     vec3 normal;
     double t;
-    std::shared_ptr<Material> mat;
+    // plain pointer, the scene owns its materials for as long as anything traces against it
+    const Material *mat = nullptr;
+    // primitive that was hit, lets the camera tell which light a bounce ran into
+    const Hittable *object = nullptr;
     // uses strategy of always setting normal opposite to incoming ray
     bool front_face;
     // texels
@@ -36,6 +41,52 @@ public:
     virtual bool hit(const Ray &ray, Interval t_limits, hit_info &info) const = 0;
 
     virtual AABB boundingBox() const = 0;
+
+    // bounds of the object at a point in the shutter interval [0, 1]
+    // lerping the boxes at time 0 and time 1 has to contain the object at any time in between,
+    // objects that do not move (or do not know how they move) just return their whole box
+    virtual AABB boundingBoxAt(double time) const { return boundingBox(); }
+
+    // entry and exit parameters of the ray's line through a convex object (volume boundaries), false if it misses.
+    // convex shapes override this with a single solve, the default falls back to two generic hit queries
+    virtual bool convexSpan(const Ray &ray, Interval &span) const
+    {
+        hit_info hit1, hit2;
+        if (!hit(ray, universe, hit1))
+        {
+            return false;
+        }
+        if (!hit(ray, Interval(hit1.t + 0.0001, infinity), hit2))
+        {
+            return false;
+        }
+        span = Interval(hit1.t, hit2.t);
+        return true;
+    }
+
+    // share of light that gets through the object along ray within t_limits, for shadow rays. a surface blocks all of
+    // it when hit, media override this with an estimate of how much passes (HeterogeneousMedium's ratio tracking), and
+    // containers multiply their children's. 0 as soon as anything opaque is in the way
+    virtual double transmittance(const Ray &ray, Interval t_limits) const
+    {
+        hit_info info;
+        return hit(ray, t_limits, info) ? 0 : 1;
+    }
+
+    // calls visit on every material the object can hand out in a hit, used to build flat material tables
+    virtual void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const {}
+
+    // light sampling, see lights.h. calls visit on every emitter the object can sample directly,
+    // objects it cannot (lights behind a transform, say) are still found by bounces, just not aimed at
+    virtual void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const {}
+    virtual double area() const { return 0; }
+    // density (over solid angle) of randomDirection picking direction from origin
+    virtual double pdfValue(const Point3 &origin, const vec3 &direction, double time) const { return 0; }
+    // a direction from origin towards the object, (u1, u2) uniform in [0, 1)
+    virtual vec3 randomDirection(const Point3 &origin, double time, double u1, double u2) const { return vec3(1, 0, 0); }
+    // a point uniform over the object's surface, for emitting light from it (caustics.h). fills p, the outward
+    // normal, u, v, mat and object of info. false if the object cannot
+    virtual bool samplePoint(double time, double u1, double u2, hit_info &info) const { return false; }
 };
 
 class Translate : public Hittable
@@ -59,6 +110,19 @@ public:
         info.p += offset;
         return true;
     }
+    bool convexSpan(const Ray &ray, Interval &span) const override
+    {
+        // translation does not change ray parameters
+        return object->convexSpan(Ray(ray.origin() - offset, ray.direction(), ray.time()), span);
+    }
+    double transmittance(const Ray &ray, Interval t_limits) const override
+    {
+        return object->transmittance(Ray(ray.origin() - offset, ray.direction(), ray.time()), t_limits);
+    }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        object->visitMaterials(visit);
+    }
     AABB boundingBox() const override { return bbox; }
 
 private:
@@ -105,18 +169,8 @@ public:
     }
     bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
     {
-        auto origin = ray.origin();
-        auto dir = ray.direction();
-
         // same strategy as translation, just need to handle normal as well now.
-
-        // rotate the ray backwards
-        origin[0] = cos_theta * ray.origin()[0] - sin_theta * ray.origin()[2];
-        origin[2] = sin_theta * ray.origin()[0] + cos_theta * ray.origin()[2];
-        dir[0] = cos_theta * ray.direction()[0] - sin_theta * ray.direction()[2];
-        dir[2] = sin_theta * ray.direction()[0] + cos_theta * ray.direction()[2];
-
-        Ray rotated_ray(origin, dir, ray.time());
+        Ray rotated_ray = rotatedRay(ray);
 
         // check for hit with rotated ray
         if (!object->hit(rotated_ray, t_limits, info))
@@ -126,17 +180,27 @@ public:
 
         // rotate the POI and normal forward
         // i.e change the normal from object space to world space
-        auto p = info.p;
-        auto normal = info.normal;
-        p[0] = cos_theta * info.p[0] + sin_theta * info.p[2];
-        p[2] = -sin_theta * info.p[0] + cos_theta * info.p[2];
-        normal[0] = cos_theta * info.normal[0] + sin_theta * info.normal[2];
-        normal[2] = -sin_theta * info.normal[0] + cos_theta * info.normal[2];
-
-        info.p = p;
-        info.normal = normal;
+        // built whole rather than written a component at a time, which the simd vec3 has to do through memory
+        const auto &p = info.p;
+        const auto &normal = info.normal;
+        info.p = Point3(cos_theta * p.x() + sin_theta * p.z(), p.y(), -sin_theta * p.x() + cos_theta * p.z());
+        info.normal = vec3(cos_theta * normal.x() + sin_theta * normal.z(), normal.y(),
+                           -sin_theta * normal.x() + cos_theta * normal.z());
         return true;
     }
+    bool convexSpan(const Ray &ray, Interval &span) const override
+    {
+        // neither does a rotation
+        return object->convexSpan(rotatedRay(ray), span);
+    }
+    double transmittance(const Ray &ray, Interval t_limits) const override
+    {
+        return object->transmittance(rotatedRay(ray), t_limits);
+    }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        object->visitMaterials(visit);
+    }
     AABB boundingBox() const override {return bbox;}
 
 private:
@@ -144,4 +208,15 @@ private:
     double sin_theta;
     double cos_theta;
     AABB bbox;
+
+    Ray rotatedRay(const Ray &ray) const
+    {
+        auto o = ray.origin();
+        auto d = ray.direction();
+
+        // rotate the ray backwards
+        Point3 origin(cos_theta * o.x() - sin_theta * o.z(), o.y(), sin_theta * o.x() + cos_theta * o.z());
+        vec3 dir(cos_theta * d.x() - sin_theta * d.z(), d.y(), sin_theta * d.x() + cos_theta * d.z());
+        return Ray(origin, dir, ray.time());
+    }
 };
@@ -49,6 +49,34 @@ public:
 
         return hit_anything;
     }
+    double transmittance(const Ray &ray, Interval t_limits) const override
+    {
+        double result = 1;
+        for (const auto &object : objects)
+        {
+            result *= object->transmittance(ray, t_limits);
+            if (result <= 0)
+            {
+                break;
+            }
+        }
+        return result;
+    }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        for (const auto &object : objects)
+        {
+            object->visitMaterials(visit);
+        }
+    }
+    void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const override
+    {
+        for (const auto &object : objects)
+        {
+            object->visitLights(visit);
+        }
+    }
     private:
-    AABB bbox;
+    // starts empty, a default Interval is the whole line and would swallow every box added to it
+    AABB bbox = AABB(Interval(+infinity, -infinity), Interval(+infinity, -infinity), Interval(+infinity, -infinity));
 };
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "../external/stb_image.h"
 #include <cstdlib>
 #include <iostream>
+#include "trace.h"
 
 class Image
 {
@@ -10,6 +11,7 @@ public:
     Image() : data(nullptr) {}
     Image(const char *file_name)
     {
+        TraceScope scope("texture decode", "io");
         auto filename = std::string(file_name);
         //taking advantage of short circuiting here
         if (load("../images/" + filename) || load("./images/" + filename) || load("../../images/" + filename))
@@ -54,4 +56,38 @@ private:
             x = low;
         return x;
     }
-};
\ No newline at end of file
+};
+// linear float rgb image (.hdr, or any format stb reads, converted to linear), same search paths as Image
+class HdrImage
+{
+public:
+    HdrImage() : data(nullptr) {}
+    HdrImage(const char *file_name) : data(nullptr)
+    {
+        TraceScope scope("hdr decode", "io");
+        auto filename = std::string(file_name);
+        if (load("../images/" + filename) || load("./images/" + filename) || load("../../images/" + filename))
+        {
+            return;
+        }
+        std::cerr << "Failed to load image " << filename << '\n';
+    }
+    ~HdrImage() { STBI_FREE(data); }
+    HdrImage(const HdrImage &) = delete;
+    HdrImage &operator=(const HdrImage &) = delete;
+    bool load(const std::string file_name)
+    {
+        int n;
+        data = stbi_loadf(file_name.c_str(), &img_width, &img_height, &n, 3);
+        return data != nullptr;
+    }
+    // three floats, x and y must be inside the image
+    const float *pixelData(int x, int y) const { return data + 3 * (static_cast<size_t>(y) * img_width + x); }
+    int width() const { return (data == nullptr) ? 0 : img_width; }
+    int height() const { return (data == nullptr) ? 0 : img_height; }
+
+private:
+    float *data;
+    int img_width = 0;
+    int img_height = 0;
+};
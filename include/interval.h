@@ -10,15 +10,15 @@ public:
     // exclusively for bbox, basically does expand/larger interval op for these
     Interval(const Interval &i1, const Interval &i2) : min(fmin(i1.min, i2.min)), max(fmax(i1.max, i2.max)) {}
 
-    bool contains(const double x)
+    bool contains(const double x) const
     {
         return x >= min && x <= max;
     }
-    bool surrounds(const double x)
+    bool surrounds(const double x) const
     {
         return x > min && x < max;
     }
-    double size()
+    double size() const
     {
         return max - min;
     }
@@ -27,7 +27,7 @@ public:
         auto padding_by_two = padding / 2;
         return Interval(min - padding_by_two, max + padding_by_two);
     }
-    double clamp(double x)
+    double clamp(double x) const
     {
         if (x < min)
             return min;
@@ -0,0 +1,263 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "aabb.h"
+#include "alias_table.h"
+#include "hittable.h"
+#include "material.h"
+#include "render_buffers.h"
+
+// how the camera picks which light to aim a shading point's light sample at
+enum LightSelection
+{
+    LIGHTS_NONE,    // never sample lights directly, they are only found by bounces (the old behaviour)
+    LIGHTS_UNIFORM, // every light equally likely
+    LIGHTS_POWER,   // proportional to emitted power, alias table
+    LIGHTS_BVH,     // proportional to an estimate of each light's contribution at the shading point, light bvh
+};
+
+struct Light
+{
+    const Hittable *shape;
+    AABB bounds;
+    double power; // luminance of the total emitted flux, estimated from the emission at the middle of the shape
+};
+
+// The emitters of a scene and a way to pick one of them for a shading point.
+// With many lights uniform picking wastes almost every sample on lights that are far away or dim, and picking by
+// power still ignores distance. The light bvh groups lights spatially, each node keeps its bounds and total power,
+// and a pick walks down from the root choosing a child by how much it could contribute at the point (power over
+// squared distance, times how well the node faces the receiving surface). Any light's probability is found again
+// by walking its recorded path, which multiple importance sampling needs when a bounce runs into a light.
+class LightSet
+{
+public:
+    void build(const Hittable &world, LightSelection _selection)
+    {
+        selection = _selection;
+        lights.clear();
+        ids.clear();
+        nodes.clear();
+        trails.clear();
+        if (selection == LIGHTS_NONE)
+        {
+            return;
+        }
+        world.visitLights([&](const Hittable &shape, const Material &emitter)
+                          {
+            if (ids.count(&shape))
+                return;
+            auto box = shape.boundingBox();
+            Point3 middle((box.x.min + box.x.max) / 2, (box.y.min + box.y.max) / 2, (box.z.min + box.z.max) / 2);
+            auto power = pi * shape.area() * luminance(emitter.emitted(0.5, 0.5, middle));
+            if (power <= 0)
+                return;
+            ids[&shape] = static_cast<int>(lights.size());
+            lights.push_back(Light{&shape, box, power}); });
+
+        if (lights.empty())
+        {
+            return;
+        }
+        std::vector<double> powers;
+        for (const auto &light : lights)
+        {
+            powers.push_back(light.power);
+        }
+        power_table.build(powers);
+
+        if (selection == LIGHTS_BVH)
+        {
+            trails.assign(lights.size(), 0);
+            std::vector<int> order(lights.size());
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                order[i] = static_cast<int>(i);
+            }
+            buildNode(order, 0, static_cast<int>(order.size()), 0, 0);
+        }
+    }
+
+    int size() const { return static_cast<int>(lights.size()); }
+    const Light &light(int index) const { return lights[index]; }
+
+    // index of the light for a hit primitive, -1 if it is not one the set samples
+    int find(const Hittable *object) const
+    {
+        auto found = ids.find(object);
+        return found == ids.end() ? -1 : found->second;
+    }
+
+    // picks a light for a shading point at p, normal is zero for points inside media (no preferred side).
+    // false if no light can contribute
+    bool pick(const Point3 &p, const vec3 &normal, double u, int &index, double &pmf) const
+    {
+        if (lights.empty())
+        {
+            return false;
+        }
+        switch (selection)
+        {
+        case LIGHTS_UNIFORM:
+            index = std::min(static_cast<int>(u * lights.size()), size() - 1);
+            pmf = 1.0 / lights.size();
+            return true;
+        case LIGHTS_POWER:
+            index = power_table.sample(u, pmf);
+            return true;
+        default:
+            break;
+        }
+
+        int node = 0;
+        pmf = 1;
+        while (nodes[node].light < 0)
+        {
+            auto left = importance(nodes[nodes[node].left], p, normal);
+            auto right = importance(nodes[nodes[node].right], p, normal);
+            if (left + right <= 0)
+            {
+                return false;
+            }
+            // reuse u for the next level, rescaled to the part of [0, 1) that picked this child
+            auto p_left = left / (left + right);
+            if (u < p_left)
+            {
+                u = fmin(u / p_left, 1 - 1e-12);
+                pmf *= p_left;
+                node = nodes[node].left;
+            }
+            else
+            {
+                u = fmin((u - p_left) / (1 - p_left), 1 - 1e-12);
+                pmf *= 1 - p_left;
+                node = nodes[node].right;
+            }
+        }
+        index = nodes[node].light;
+        return true;
+    }
+
+    // probability of pick choosing light index for a shading point at p
+    double pmf(const Point3 &p, const vec3 &normal, int index) const
+    {
+        switch (selection)
+        {
+        case LIGHTS_UNIFORM:
+            return 1.0 / lights.size();
+        case LIGHTS_POWER:
+            return power_table.pmf(index);
+        default:
+            break;
+        }
+
+        auto trail = trails[index];
+        int node = 0;
+        double pmf = 1;
+        while (nodes[node].light < 0)
+        {
+            auto left = importance(nodes[nodes[node].left], p, normal);
+            auto right = importance(nodes[nodes[node].right], p, normal);
+            if (left + right <= 0)
+            {
+                return 0;
+            }
+            bool go_left = (trail & 1) == 0;
+            pmf *= (go_left ? left : right) / (left + right);
+            node = go_left ? nodes[node].left : nodes[node].right;
+            trail >>= 1;
+        }
+        return pmf;
+    }
+
+private:
+    struct LightNode
+    {
+        AABB bounds;
+        double power = 0;
+        int left = -1;
+        int right = -1;
+        int light = -1; // leaves hold a single light
+    };
+
+    LightSelection selection = LIGHTS_NONE;
+    std::vector<Light> lights;
+    std::unordered_map<const Hittable *, int> ids;
+    AliasTable power_table;
+    std::vector<LightNode> nodes;
+    std::vector<uint64_t> trails; // per light, the left (0) / right (1) turns from the root down to its leaf
+
+    // same median split on the longest axis as BVHNode, over light centers. that keeps the tree balanced,
+    // so a trail fits in 64 bits for any number of lights that fits in memory
+    int buildNode(std::vector<int> &order, int start, int end, int depth, uint64_t trail)
+    {
+        int id = static_cast<int>(nodes.size());
+        nodes.push_back(LightNode());
+        if (end - start == 1)
+        {
+            int light = order[start];
+            nodes[id].bounds = lights[light].bounds;
+            nodes[id].power = lights[light].power;
+            nodes[id].light = light;
+            trails[light] = trail;
+            return id;
+        }
+
+        AABB centers(Interval(+infinity, -infinity), Interval(+infinity, -infinity), Interval(+infinity, -infinity));
+        for (int i = start; i < end; i++)
+        {
+            auto c = center(lights[order[i]].bounds);
+            centers = AABB(centers, AABB(c, c));
+        }
+        int axis = 0;
+        if (centers.y.size() > centers.getAxis(axis).size())
+            axis = 1;
+        if (centers.z.size() > centers.getAxis(axis).size())
+            axis = 2;
+        int mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b)
+                         { return center(lights[a].bounds)[axis] < center(lights[b].bounds)[axis]; });
+
+        int left = buildNode(order, start, mid, depth + 1, trail);
+        int right = buildNode(order, mid, end, depth + 1, trail | (uint64_t(1) << depth));
+        nodes[id].left = left;
+        nodes[id].right = right;
+        nodes[id].bounds = AABB(nodes[left].bounds, nodes[right].bounds);
+        nodes[id].power = nodes[left].power + nodes[right].power;
+        return id;
+    }
+
+    static Point3 center(const AABB &b)
+    {
+        return Point3((b.x.min + b.x.max) / 2, (b.y.min + b.y.max) / 2, (b.z.min + b.z.max) / 2);
+    }
+
+    // conservative estimate of what a node's lights can add at p: power over squared distance, with the distance
+    // clamped to the node's size so points near or inside it do not blow up, times the best cosine any point of the
+    // node can make with the receiving normal
+    static double importance(const LightNode &node, const Point3 &p, const vec3 &normal)
+    {
+        vec3 to_center = center(node.bounds) - p;
+        auto dist_sqr = to_center.sqrLength();
+        auto half_diagonal = vec3(node.bounds.x.size(), node.bounds.y.size(), node.bounds.z.size()) / 2;
+        auto radius_sqr = half_diagonal.sqrLength();
+
+        double cos_bound = 1;
+        if (normal.sqrLength() > 0 && dist_sqr > radius_sqr)
+        {
+            // angle from the normal to the center, less the half angle the node's bounding sphere subtends
+            auto sin_b_sqr = radius_sqr / dist_sqr;
+            auto cos_b = sqrt(1 - sin_b_sqr);
+            auto cos_i = to_center.dot(normal) / sqrt(dist_sqr);
+            if (cos_i < cos_b)
+            {
+                auto sin_i = sqrt(fmax(0.0, 1 - cos_i * cos_i));
+                cos_bound = fmax(0.0, cos_i * cos_b + sin_i * sqrt(sin_b_sqr));
+            }
+        }
+        return node.power * cos_bound / fmax(dist_sqr, radius_sqr);
+    }
+};
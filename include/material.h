@@ -1,24 +1,59 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include "utilities.h"
 #include "hittable.h"
 #include "ray.h"
 #include "color.h"
 #include "texture.h"
+#include "sampler.h"
 
 class hit_info;
 
 class Material
 {
 public:
+    Material() : id(nextId()) {}
+    // a copy is a material of its own and gets its own id
+    Material(const Material &) : id(nextId()) {}
+    Material &operator=(const Material &) { return *this; }
     virtual ~Material() = default;
 
-    virtual bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const = 0;
+    // numbered densely in the order materials are made and never changed, so material tables (material_table.h) can
+    // index by it without writing to the material
+    const uint32_t id;
+
+    virtual bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const = 0;
 
     virtual Color emitted(double u, double v, const Point3 &p) const
     {
         return Color(0, 0, 0);
     }
+
+    // base color of the surface at a hit, only used as a denoiser guide, never for shading
+    virtual Color surfaceAlbedo(const hit_info &info) const
+    {
+        return Color(1, 1, 1);
+    }
+
+    // density of scatter picking scattered's direction, zero for specular (or unknown) lobes.
+    // where it is not zero, attenuation * scatteringPdf is the share of light arriving along scattered that leaves
+    // along ray_in, which is what lets the camera sample lights directly
+    virtual double scatteringPdf(const Ray &ray_in, const hit_info &info, const Ray &scattered) const
+    {
+        return 0;
+    }
+    virtual bool emits() const { return false; }
+    // phase functions of participating media, the hit normal means nothing for these
+    virtual bool isVolumetric() const { return false; }
+
+private:
+    static uint32_t nextId()
+    {
+        static std::atomic<uint32_t> next{0};
+        return next++;
+    }
 };
 
 class Lambertian : public Material
@@ -26,20 +61,39 @@ class Lambertian : public Material
 public:
     Lambertian(const Color &col) : albedo(std::make_shared<SolidColor>(col)) {}
     Lambertian(std::shared_ptr<Texture> tex) : albedo(tex) {}
-    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const override
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const override
     {
         // always scatters
+        scatterDiffuse(ray_in, info, scattered, sampler);
+        attenuation = albedo->value(info.u, info.v, info.p);
+        return true;
+    }
+    // the direction sampling on its own, shared with the flat material table
+    static void scatterDiffuse(const Ray &ray_in, hit_info &info, Ray &scattered, Sampler &sampler)
+    {
         // the math for this Lambertian diffusion is beautiful, read up again.
-        auto scatter_direction = info.normal + randomUnitVec();
+        double u1, u2;
+        sampler.get2D(u1, u2);
+        auto scatter_direction = info.normal + sampleUnitSphere(u1, u2);
 
-        // to check for case when randomUnitVec() is exactly opposite info.normal
+        // to check for case when the sphere sample is exactly opposite info.normal
         if (scatter_direction.near_zero())
         {
             scatter_direction = info.normal;
         }
         scattered = Ray(info.p, scatter_direction, ray_in.time());
-        attenuation = albedo->value(info.u, info.v, info.p);
-        return true;
+    }
+    Color surfaceAlbedo(const hit_info &info) const override { return albedo->value(info.u, info.v, info.p); }
+    std::shared_ptr<Texture> texture() const { return albedo; }
+    double scatteringPdf(const Ray &ray_in, const hit_info &info, const Ray &scattered) const override
+    {
+        return diffusePdf(info, scattered);
+    }
+    // normal + a point on the unit sphere is cosine distributed about the normal
+    static double diffusePdf(const hit_info &info, const Ray &scattered)
+    {
+        auto cos_theta = normalize(scattered.direction()).dot(info.normal);
+        return cos_theta < 0 ? 0 : cos_theta / pi;
     }
 
 private:
@@ -50,15 +104,24 @@ class Metal : public Material
 {
 public:
     Metal(const Color &col, double f) : albedo(col), fuzz(f < 1 ? f : 1) {}
-    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const override
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const override
+    {
+        attenuation = albedo;
+        return scatterGlossy(ray_in, info, fuzz, scattered, sampler);
+    }
+    static bool scatterGlossy(const Ray &ray_in, hit_info &info, double fuzz, Ray &scattered, Sampler &sampler)
     {
         vec3 dir = normalize(ray_in.direction());
         vec3 reflected_direction = reflect(dir, info.normal);
-        scattered = Ray(info.p, reflected_direction + fuzz * randomUnitVec(), ray_in.time());
-        attenuation = albedo;
+        double u1, u2;
+        sampler.get2D(u1, u2);
+        scattered = Ray(info.p, reflected_direction + fuzz * sampleUnitSphere(u1, u2), ray_in.time());
         // to count out reflections below the surface
         return info.normal.dot(scattered.direction());
     }
+    Color surfaceAlbedo(const hit_info &info) const override { return albedo; }
+    Color color() const { return albedo; }
+    double fuzziness() const { return fuzz; }
 
 private:
     // albedo = proportion of incident light reflected.
@@ -70,11 +133,16 @@ class Dielectric : public Material
 {
 public:
     Dielectric(double refractive_index) : eta(refractive_index) {}
-    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const override
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const override
     {
         // always refracts
         attenuation = Color(1.0, 1.0, 1.0);
-        double refractive_ibyr = info.front_face ? 1.0 / eta : eta;
+        scatterGlass(ray_in, info, eta, scattered, sampler);
+        return true;
+    }
+    static void scatterGlass(const Ray &ray_in, hit_info &info, double refractive_index, Ray &scattered, Sampler &sampler)
+    {
+        double refractive_ibyr = info.front_face ? 1.0 / refractive_index : refractive_index;
         // calculations expect unit vector
         vec3 unit_dir = normalize(ray_in.direction());
         // to check for TIR
@@ -83,7 +151,7 @@ public:
 
         bool cannot_refract = refractive_ibyr * sin_theta > 1.0;
         vec3 scattered_direction;
-        if (cannot_refract || reflectance(cos_theta, refractive_ibyr) > randomDouble())
+        if (cannot_refract || reflectance(cos_theta, refractive_ibyr) > sampler.get1D())
         {
             scattered_direction = reflect(unit_dir, info.normal);
         }
@@ -92,8 +160,8 @@ public:
             scattered_direction = refract(unit_dir, info.normal, refractive_ibyr);
         }
         scattered = Ray(info.p, scattered_direction, ray_in.time());
-        return true;
     }
+    double refractiveIndex() const { return eta; }
 
 private:
     double eta;
@@ -102,7 +170,9 @@ private:
     {
         auto r0 = (1 - ri) / (1 + ri);
         r0 = r0 * r0;
-        return r0 + (1 - r0) * pow((1 - cos), 5);
+        // (1 - cos)^5 by hand, pow is a general purpose call
+        auto x = 1 - cos, x2 = x * x;
+        return r0 + (1 - r0) * x2 * x2 * x;
     }
 };
 
@@ -110,7 +180,7 @@ class DiffuseLight : public Material
 {
 public:
     DiffuseLight(std::shared_ptr<Texture> _emit) : emit(_emit) {}
-    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const override
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const override
     {
         return false;
     }
@@ -118,6 +188,9 @@ public:
     {
         return emit->value(u, v, p);
     }
+    Color surfaceAlbedo(const hit_info &info) const override { return emit->value(info.u, info.v, info.p); }
+    bool emits() const override { return true; }
+    std::shared_ptr<Texture> texture() const { return emit; }
 
 private:
     std::shared_ptr<Texture> emit;
@@ -128,13 +201,26 @@ public:
     Isotropic(Color c) : albedo(std::make_shared<SolidColor>(c)) {}
     Isotropic(std::shared_ptr<Texture> a) : albedo(a) {}
 
-    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered) const override
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const override
     {
-        //random unit vector scattered in any direction from point of contact
-        scattered = Ray(info.p, randomUnitVec(), ray_in.time());
+        scatterUniform(ray_in, info, scattered, sampler);
         attenuation = albedo -> value(info.u, info.v, info.p);
         return true;
     }
+    static void scatterUniform(const Ray &ray_in, hit_info &info, Ray &scattered, Sampler &sampler)
+    {
+        //random unit vector scattered in any direction from point of contact
+        double u1, u2;
+        sampler.get2D(u1, u2);
+        scattered = Ray(info.p, sampleUnitSphere(u1, u2), ray_in.time());
+    }
+    Color surfaceAlbedo(const hit_info &info) const override { return albedo->value(info.u, info.v, info.p); }
+    std::shared_ptr<Texture> texture() const { return albedo; }
+    double scatteringPdf(const Ray &ray_in, const hit_info &info, const Ray &scattered) const override
+    {
+        return 1 / (4 * pi);
+    }
+    bool isVolumetric() const override { return true; }
     private:
     std::shared_ptr<Texture> albedo;
 };
\ No newline at end of file
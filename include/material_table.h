@@ -0,0 +1,338 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include "hittable.h"
+#include "material.h"
+#include "texture.h"
+#include "sampler.h"
+
+// Closed, flat copy of a scene's materials and textures for shading.
+// Every built in material and texture becomes a small tagged record in one of two arrays, referenced by index, and
+// scatter / emitted / albedo dispatch on the tag with a switch instead of virtual calls through shared_ptrs.
+// Constant colors (a Lambertian's SolidColor, say) are stored inline in the material record, so the common case
+// reads one record and no texture at all.
+// Types the table does not know (anything deriving further from the built in classes too) are kept as custom
+// records that go back to the virtual functions, so new materials and textures still only need a subclass.
+class MaterialTable
+{
+public:
+    enum TextureKind
+    {
+        TEXTURE_SOLID,
+        TEXTURE_CHECKER,
+        TEXTURE_IMAGE,
+        TEXTURE_NOISE,
+        TEXTURE_CUSTOM,
+    };
+    enum MaterialKind
+    {
+        MATERIAL_LAMBERTIAN,
+        MATERIAL_METAL,
+        MATERIAL_DIELECTRIC,
+        MATERIAL_DIFFUSE_LIGHT,
+        MATERIAL_ISOTROPIC,
+        MATERIAL_CUSTOM,
+    };
+
+    struct TextureRecord
+    {
+        TextureKind kind;
+        Color color;                     // solid
+        double inverse_scale = 0;        // checker
+        int even = -1;                   // checker, texture index
+        int odd = -1;                    // checker, texture index
+        const Texture *source = nullptr; // image, noise and custom are evaluated on the object itself
+    };
+    struct MaterialRecord
+    {
+        MaterialKind kind;
+        int texture = -1;                 // albedo / emission texture, -1 when constant and inlined in color
+        Color color;                      // constant albedo or emission, metal color
+        double parameter = 0;             // metal fuzz, dielectric refractive index
+        const Material *source = nullptr; // the material this record was built from
+    };
+
+    void clear()
+    {
+        materials.clear();
+        textures.clear();
+        owned_materials.clear();
+        owned_textures.clear();
+        texture_ids.clear();
+        record_of.clear();
+        first_id = 0;
+    }
+
+    // collects every material reachable from world. the scene is only read, which material has which record is kept
+    // here (by material id), so any number of tables can be built over the same scene at once
+    void build(const Hittable &world)
+    {
+        clear();
+        std::vector<std::shared_ptr<Material>> found;
+        world.visitMaterials([&](const std::shared_ptr<Material> &material)
+                             {
+            if (material != nullptr)
+                found.push_back(material); });
+        if (found.empty())
+        {
+            return;
+        }
+        // a scene's materials are mostly made together, so their ids span little more than their count
+        uint32_t last_id = 0;
+        first_id = found[0]->id;
+        for (const auto &material : found)
+        {
+            first_id = std::min(first_id, material->id);
+            last_id = std::max(last_id, material->id);
+        }
+        record_of.assign(last_id - first_id + 1, -1);
+        for (const auto &material : found)
+        {
+            auto &record = record_of[material->id - first_id];
+            if (record < 0)
+            {
+                record = addMaterial(material);
+            }
+        }
+        texture_ids.clear();
+    }
+
+    size_t materialCount() const { return materials.size(); }
+    size_t textureCount() const { return textures.size(); }
+
+    // same contracts as the Material functions of the same names
+    bool scatter(const Ray &ray_in, hit_info &info, Color &attenuation, Ray &scattered, Sampler &sampler) const
+    {
+        auto record = find(info.mat);
+        if (record == nullptr)
+        {
+            return info.mat->scatter(ray_in, info, attenuation, scattered, sampler);
+        }
+        switch (record->kind)
+        {
+        case MATERIAL_LAMBERTIAN:
+            Lambertian::scatterDiffuse(ray_in, info, scattered, sampler);
+            attenuation = value(*record, info);
+            return true;
+        case MATERIAL_METAL:
+            attenuation = record->color;
+            return Metal::scatterGlossy(ray_in, info, record->parameter, scattered, sampler);
+        case MATERIAL_DIELECTRIC:
+            attenuation = Color(1.0, 1.0, 1.0);
+            Dielectric::scatterGlass(ray_in, info, record->parameter, scattered, sampler);
+            return true;
+        case MATERIAL_DIFFUSE_LIGHT:
+            return false;
+        case MATERIAL_ISOTROPIC:
+            Isotropic::scatterUniform(ray_in, info, scattered, sampler);
+            attenuation = value(*record, info);
+            return true;
+        default:
+            return record->source->scatter(ray_in, info, attenuation, scattered, sampler);
+        }
+    }
+    Color emitted(const hit_info &info) const
+    {
+        auto record = find(info.mat);
+        if (record == nullptr || record->kind == MATERIAL_CUSTOM)
+        {
+            return info.mat->emitted(info.u, info.v, info.p);
+        }
+        return record->kind == MATERIAL_DIFFUSE_LIGHT ? value(*record, info) : Color(0, 0, 0);
+    }
+    Color surfaceAlbedo(const hit_info &info) const
+    {
+        auto record = find(info.mat);
+        if (record == nullptr)
+        {
+            return info.mat->surfaceAlbedo(info);
+        }
+        switch (record->kind)
+        {
+        case MATERIAL_LAMBERTIAN:
+        case MATERIAL_DIFFUSE_LIGHT:
+        case MATERIAL_ISOTROPIC:
+            return value(*record, info);
+        case MATERIAL_METAL:
+            return record->color;
+        case MATERIAL_DIELECTRIC:
+            return Color(1, 1, 1);
+        default:
+            return record->source->surfaceAlbedo(info);
+        }
+    }
+
+    double scatteringPdf(const Ray &ray_in, const hit_info &info, const Ray &scattered) const
+    {
+        auto record = find(info.mat);
+        if (record == nullptr || record->kind == MATERIAL_CUSTOM)
+        {
+            return info.mat->scatteringPdf(ray_in, info, scattered);
+        }
+        switch (record->kind)
+        {
+        case MATERIAL_LAMBERTIAN:
+            return Lambertian::diffusePdf(info, scattered);
+        case MATERIAL_ISOTROPIC:
+            return 1 / (4 * pi);
+        default:
+            return 0;
+        }
+    }
+    bool isVolumetric(const hit_info &info) const
+    {
+        auto record = find(info.mat);
+        if (record == nullptr || record->kind == MATERIAL_CUSTOM)
+        {
+            return info.mat->isVolumetric();
+        }
+        return record->kind == MATERIAL_ISOTROPIC;
+    }
+
+    Color textureValue(int id, double u, double v, const Point3 &point) const
+    {
+        const auto &texture = textures[id];
+        switch (texture.kind)
+        {
+        case TEXTURE_SOLID:
+            return texture.color;
+        case TEXTURE_CHECKER:
+        {
+            // same parity rule as CheckerTexture::value
+            auto xInt = static_cast<int>(std::floor(texture.inverse_scale * point.x()));
+            auto yInt = static_cast<int>(std::floor(texture.inverse_scale * point.y()));
+            auto zInt = static_cast<int>(std::floor(texture.inverse_scale * point.z()));
+            bool isEven = (xInt + yInt + zInt) % 2;
+            return textureValue(isEven ? texture.even : texture.odd, u, v, point);
+        }
+        // qualified calls, these are exact types so there is nothing to look up
+        case TEXTURE_IMAGE:
+            return static_cast<const ImageTexture *>(texture.source)->ImageTexture::value(u, v, point);
+        case TEXTURE_NOISE:
+            return static_cast<const NoiseTexture *>(texture.source)->NoiseTexture::value(u, v, point);
+        default:
+            return texture.source->value(u, v, point);
+        }
+    }
+
+private:
+    std::vector<MaterialRecord> materials;
+    std::vector<TextureRecord> textures;
+    // records point into these, holding them keeps the table valid even if the scene lets go first
+    std::vector<std::shared_ptr<Material>> owned_materials;
+    std::vector<std::shared_ptr<Texture>> owned_textures;
+    std::unordered_map<const Texture *, int> texture_ids; // only used while building
+    // record index of each material id from first_id on, -1 for ids not in the scene
+    std::vector<int> record_of;
+    uint32_t first_id = 0;
+
+    // null for a material added after the build, which then takes the virtual path
+    const MaterialRecord *find(const Material *material) const
+    {
+        // ids below first_id wrap around to past the end
+        auto slot = static_cast<size_t>(material->id - first_id);
+        return slot < record_of.size() && record_of[slot] >= 0 ? &materials[record_of[slot]] : nullptr;
+    }
+
+    Color value(const MaterialRecord &record, const hit_info &info) const
+    {
+        return record.texture < 0 ? record.color : textureValue(record.texture, info.u, info.v, info.p);
+    }
+
+    int addMaterial(const std::shared_ptr<Material> &material)
+    {
+        MaterialRecord record;
+        record.source = material.get();
+        const auto &type = typeid(*material);
+        if (type == typeid(Lambertian))
+        {
+            record.kind = MATERIAL_LAMBERTIAN;
+            setTexture(record, static_cast<const Lambertian &>(*material).texture());
+        }
+        else if (type == typeid(Metal))
+        {
+            const auto &metal = static_cast<const Metal &>(*material);
+            record.kind = MATERIAL_METAL;
+            record.color = metal.color();
+            record.parameter = metal.fuzziness();
+        }
+        else if (type == typeid(Dielectric))
+        {
+            record.kind = MATERIAL_DIELECTRIC;
+            record.parameter = static_cast<const Dielectric &>(*material).refractiveIndex();
+        }
+        else if (type == typeid(DiffuseLight))
+        {
+            record.kind = MATERIAL_DIFFUSE_LIGHT;
+            setTexture(record, static_cast<const DiffuseLight &>(*material).texture());
+        }
+        else if (type == typeid(Isotropic))
+        {
+            record.kind = MATERIAL_ISOTROPIC;
+            setTexture(record, static_cast<const Isotropic &>(*material).texture());
+        }
+        else
+        {
+            record.kind = MATERIAL_CUSTOM;
+        }
+        int id = static_cast<int>(materials.size());
+        materials.push_back(record);
+        owned_materials.push_back(material);
+        return id;
+    }
+
+    void setTexture(MaterialRecord &record, const std::shared_ptr<Texture> &texture)
+    {
+        if (typeid(*texture) == typeid(SolidColor))
+        {
+            record.color = static_cast<const SolidColor &>(*texture).colorValue();
+            record.texture = -1;
+            return;
+        }
+        record.texture = addTexture(texture);
+    }
+
+    int addTexture(const std::shared_ptr<Texture> &texture)
+    {
+        auto found = texture_ids.find(texture.get());
+        if (found != texture_ids.end())
+        {
+            return found->second;
+        }
+        TextureRecord record;
+        record.source = texture.get();
+        const auto &type = typeid(*texture);
+        int id = static_cast<int>(textures.size());
+        texture_ids[texture.get()] = id;
+        owned_textures.push_back(texture);
+        if (type == typeid(SolidColor))
+        {
+            record.kind = TEXTURE_SOLID;
+            record.color = static_cast<const SolidColor &>(*texture).colorValue();
+            textures.push_back(record);
+        }
+        else if (type == typeid(CheckerTexture))
+        {
+            const auto &checker = static_cast<const CheckerTexture &>(*texture);
+            record.kind = TEXTURE_CHECKER;
+            record.inverse_scale = checker.inverseScale();
+            // claim the slot before the children, adding them grows the array
+            textures.push_back(record);
+            int even = addTexture(checker.evenTexture());
+            int odd = addTexture(checker.oddTexture());
+            textures[id].even = even;
+            textures[id].odd = odd;
+        }
+        else
+        {
+            record.kind = type == typeid(ImageTexture)   ? TEXTURE_IMAGE
+                          : type == typeid(NoiseTexture) ? TEXTURE_NOISE
+                                                         : TEXTURE_CUSTOM;
+            textures.push_back(record);
+        }
+        return id;
+    }
+};
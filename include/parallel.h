@@ -0,0 +1,45 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+inline int threadCount()
+{
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    return n > 0 ? n : 1;
+}
+
+// runs work(index) for every index in [0, count) over all cores, returns once all are done.
+// indices are handed out one at a time, so uneven work (tiles with more going on) still balances
+template <typename Work>
+void parallelFor(int count, Work work)
+{
+    int threads = std::min(threadCount(), count);
+    if (threads <= 1)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            work(i);
+        }
+        return;
+    }
+    std::atomic<int> next(0);
+    auto worker = [&]()
+    {
+        for (int i = next++; i < count; i = next++)
+        {
+            work(i);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : pool)
+    {
+        thread.join();
+    }
+}
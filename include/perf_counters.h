@@ -0,0 +1,228 @@
+#pragma once
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Hardware performance counters (Linux perf_event_open) around the phases of a run: scene build, trace and output.
+// Cycles, instructions, last level cache misses, branch misses and data TLB misses tell whether a phase waits on
+// memory (low instructions per cycle, many cache and TLB misses per thousand instructions) or on arithmetic (high
+// IPC), before layout work on the bvh is worth starting. Counters include threads and forked workers started after
+// enable(), as they exit. Whatever cannot be opened (no PMU in a VM, perf_event_paranoid, seccomp) is left out of
+// the report, and if no hardware counter opens at all the software ones (task clock, page faults) still do.
+// Phases accumulate over every time they run and must not nest.
+
+class PerfProfiler
+{
+public:
+    enum Counter
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        DTLB_MISSES,
+        TASK_CLOCK,
+        PAGE_FAULTS,
+        counter_count
+    };
+
+    static PerfProfiler &instance()
+    {
+        static PerfProfiler profiler;
+        return profiler;
+    }
+
+    // opens the counters, false if none could be
+    bool enable()
+    {
+        bool any = false;
+        for (int c = 0; c < counter_count; c++)
+        {
+            fds[c] = open(c);
+            any = any || fds[c] >= 0;
+            if (fds[c] < 0 && open_error.empty())
+            {
+                open_error = describe(errno);
+            }
+        }
+        enabled = any;
+        return any;
+    }
+    bool isEnabled() const { return enabled; }
+
+    // current (multiplexing scaled) counts, -1 where a counter is not open
+    void read(double values[]) const
+    {
+        for (int c = 0; c < counter_count; c++)
+        {
+            values[c] = -1;
+            uint64_t data[3]; // value, time enabled, time running
+            if (fds[c] >= 0 && ::read(fds[c], data, sizeof(data)) == static_cast<ssize_t>(sizeof(data)))
+            {
+                values[c] = data[2] > 0 ? static_cast<double>(data[0]) * data[1] / data[2] : 0;
+            }
+        }
+    }
+
+    void addPhase(const std::string &name, const double before[], const double after[])
+    {
+        for (auto &phase : phases)
+        {
+            if (phase.name == name)
+            {
+                accumulate(phase, before, after);
+                return;
+            }
+        }
+        phases.push_back(Phase{name, {}});
+        accumulate(phases.back(), before, after);
+    }
+
+    void report(std::ostream &out) const
+    {
+        if (!enabled)
+        {
+            out << "Performance counters unavailable (" << (open_error.empty() ? "not enabled" : open_error) << ")\n";
+            return;
+        }
+        bool hardware = fds[CYCLES] >= 0 && fds[INSTRUCTIONS] >= 0;
+        if (!hardware)
+        {
+            out << "No hardware counters (" << open_error << "), software counters only\n";
+        }
+        char line[256];
+        std::snprintf(line, sizeof(line), "%-12s %14s %14s %6s %10s %10s %10s %10s %10s\n", "phase", "cycles",
+                      "instructions", "IPC", "LLC MPKI", "br MPKI", "dTLB MPKI", "cpu ms", "faults");
+        out << line;
+        for (const auto &phase : phases)
+        {
+            const auto &v = phase.values;
+            auto per_kilo = [&](int c)
+            { return v[c] >= 0 && v[INSTRUCTIONS] > 0 ? 1000 * v[c] / v[INSTRUCTIONS] : -1; };
+            std::snprintf(line, sizeof(line), "%-12s %14s %14s %6s %10s %10s %10s %10s %10s\n", phase.name.c_str(),
+                          number(v[CYCLES], "%.0f").c_str(), number(v[INSTRUCTIONS], "%.0f").c_str(),
+                          number(v[CYCLES] > 0 && v[INSTRUCTIONS] >= 0 ? v[INSTRUCTIONS] / v[CYCLES] : -1, "%.2f").c_str(),
+                          number(per_kilo(CACHE_MISSES), "%.2f").c_str(), number(per_kilo(BRANCH_MISSES), "%.2f").c_str(),
+                          number(per_kilo(DTLB_MISSES), "%.2f").c_str(), number(v[TASK_CLOCK] >= 0 ? v[TASK_CLOCK] / 1e6 : -1, "%.1f").c_str(),
+                          number(v[PAGE_FAULTS], "%.0f").c_str());
+            out << line;
+        }
+    }
+
+private:
+    struct Phase
+    {
+        std::string name;
+        double values[counter_count];
+    };
+
+    int fds[counter_count] = {-1, -1, -1, -1, -1, -1, -1};
+    bool enabled = false;
+    std::string open_error;
+    std::vector<Phase> phases;
+
+    static int open(int counter)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (counter)
+        {
+        case CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case CACHE_MISSES:
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case BRANCH_MISSES:
+            attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case TASK_CLOCK:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_TASK_CLOCK;
+            break;
+        default:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+        }
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // user space only, which is what unprivileged users may count anyway
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static std::string describe(int error)
+    {
+        if (error == EACCES || error == EPERM)
+            return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+        if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV)
+            return "not supported by this cpu, or no PMU in this VM";
+        if (error == ENOSYS)
+            return "no perf_event_open in this kernel";
+        return std::strerror(error);
+    }
+
+    static void accumulate(Phase &phase, const double before[], const double after[])
+    {
+        for (int c = 0; c < counter_count; c++)
+        {
+            phase.values[c] = before[c] >= 0 && after[c] >= 0 ? phase.values[c] + after[c] - before[c] : -1;
+        }
+    }
+    static std::string number(double value, const char *format)
+    {
+        if (value < 0)
+        {
+            return "n/a";
+        }
+        char text[32];
+        std::snprintf(text, sizeof(text), format, value);
+        return text;
+    }
+};
+
+// counts the enclosing block towards phase name, when profiling is on
+class PerfScope
+{
+public:
+    explicit PerfScope(const char *_name) : name(_name)
+    {
+        if (PerfProfiler::instance().isEnabled())
+        {
+            PerfProfiler::instance().read(before);
+        }
+    }
+    ~PerfScope()
+    {
+        if (PerfProfiler::instance().isEnabled())
+        {
+            double after[PerfProfiler::counter_count];
+            PerfProfiler::instance().read(after);
+            PerfProfiler::instance().addPhase(name, before, after);
+        }
+    }
+    PerfScope(const PerfScope &) = delete;
+    PerfScope &operator=(const PerfScope &) = delete;
+
+private:
+    const char *name;
+    double before[PerfProfiler::counter_count];
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <memory>
+#include <typeinfo>
 #include "material.h"
 #include "aabb.h"
 #include "hittable.h"
@@ -7,6 +8,7 @@
 #include "vec3.h"
 #include "ray.h"
 #include "interval.h"
+#include "stats.h"
 
 class Quad : public Hittable
 {
@@ -15,12 +17,12 @@ public:
         : O(_O), u(_u), v(_v), mat(_mat)
     {
         // basic plane eqn principles
-        auto temp = _u;
-        auto normal = temp.cross(_v);
+        auto normal = _u.cross(_v);
         n = normalize(normal);
         D = n.dot(_O);
         setBoundingBox();
         w = normal / normal.dot(normal);
+        surface_area = normal.length();
     }
     void setBoundingBox()
     {
@@ -29,6 +31,7 @@ public:
     AABB boundingBox() const override { return bbox; }
     bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
     {
+        RT_STAT(STAT_QUAD_TESTS);
         // put ray = a + tb in n.p=D, solve for t
         auto denom = ray.direction().dot(n); // b.n
         // checking parallel
@@ -54,12 +57,60 @@ public:
 
         info.t = t;
         info.p = poi;
-        info.mat = mat;
+        info.mat = mat.get();
+        info.object = this;
         info.setNormalFace(ray, n);
 
         return true;
     }
 
+    Point3 origin() const { return O; }
+    vec3 edgeU() const { return u; }
+    vec3 edgeV() const { return v; }
+    std::shared_ptr<Material> material() const { return mat; }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        visit(mat);
+    }
+
+    void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const override
+    {
+        // sampling assumes the whole parallelogram, shapes that cut it down with isInterior are not sampled
+        if (typeid(*this) == typeid(Quad) && mat->emits())
+        {
+            visit(*this, *mat);
+        }
+    }
+    double area() const override { return surface_area; }
+    double pdfValue(const Point3 &origin, const vec3 &direction, double time) const override
+    {
+        hit_info info;
+        if (!hit(Ray(origin, direction, time), Interval(0.001, infinity), info))
+        {
+            return 0;
+        }
+        // uniform over the area, converted to solid angle
+        vec3 dir = direction;
+        auto dist_sqr = info.t * info.t * dir.sqrLength();
+        auto cosine = fabs(dir.dot(info.normal) / dir.length());
+        return dist_sqr / (cosine * surface_area);
+    }
+    vec3 randomDirection(const Point3 &origin, double time, double u1, double u2) const override
+    {
+        return O + (u1 * u) + (u2 * v) - origin;
+    }
+    bool samplePoint(double time, double u1, double u2, hit_info &info) const override
+    {
+        info.p = O + (u1 * u) + (u2 * v);
+        info.normal = n;
+        info.front_face = true;
+        info.u = u1;
+        info.v = u2;
+        info.mat = mat.get();
+        info.object = this;
+        return true;
+    }
+
     // making virtual to extend to other quadrilateral primitives, same simple principle applies everywhere
     virtual bool isInterior(double a, double b, hit_info &info) const
     {
@@ -82,6 +133,7 @@ private:
     vec3 n;
     // for checking if poi is in plane, there is a clear derivation using u, v as basis vectors for quad region.
     vec3 w;
+    double surface_area;
 };
 
 inline std::shared_ptr<HittableArray> box(const Point3& p1, const Point3& p2, std::shared_ptr<Material> mat)
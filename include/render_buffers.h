@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "color.h"
+#include "interval.h"
+#include "vec3.h"
+
+inline double luminance(const Color &c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+// t in [0, 1] to a perceptually even black, purple, red, orange, pale yellow ramp (inferno's), for cost heatmaps
+inline Color falseColor(double t)
+{
+    static const Color ramp[] = {Color(0.001, 0.000, 0.014), Color(0.341, 0.062, 0.429), Color(0.735, 0.216, 0.330),
+                                 Color(0.978, 0.557, 0.035), Color(0.988, 0.998, 0.645)};
+    t = 4 * std::min(1.0, std::max(0.0, t));
+    int k = std::min(3, static_cast<int>(t));
+    return ramp[k] + (t - k) * (ramp[k + 1] - ramp[k]);
+}
+
+// everything a render produces per pixel, row major.
+// besides the image itself these are the auxiliary (AOV) buffers a denoiser uses to tell edges from noise.
+// they may cover just a part of the image starting at pixel (x0, y0), as a streamed render's tiles do
+class RenderBuffers
+{
+public:
+    int width = 0;
+    int height = 0;
+    int x0 = 0;
+    int y0 = 0;
+    std::vector<Color> color;     // mean radiance, linear
+    std::vector<Color> albedo;    // mean first hit albedo, background color for rays that escape
+    std::vector<vec3> normal;     // mean first hit normal, zero for rays that escape
+    std::vector<double> depth;    // mean first hit distance, zero for rays that escape
+    std::vector<double> variance; // variance of the mean luminance, how noisy the pixel still is
+    // what each pixel cost over the whole render, only kept when cost heatmaps are asked for (empty otherwise)
+    std::vector<double> seconds;
+    std::vector<double> nodes; // bvh nodes visited, counted with statistics compiled in (stats.h)
+    std::vector<double> tests; // primitive intersection tests, the same
+
+    void resize(int _width, int _height, int _x0 = 0, int _y0 = 0)
+    {
+        width = _width;
+        height = _height;
+        x0 = _x0;
+        y0 = _y0;
+        size_t n = static_cast<size_t>(width) * height;
+        color.assign(n, Color(0, 0, 0));
+        albedo.assign(n, Color(0, 0, 0));
+        normal.assign(n, vec3(0, 0, 0));
+        depth.assign(n, 0);
+        variance.assign(n, 0);
+        seconds.clear();
+        nodes.clear();
+        tests.clear();
+    }
+    void trackCosts()
+    {
+        seconds.assign(color.size(), 0);
+        nodes.assign(color.size(), 0);
+        tests.assign(color.size(), 0);
+    }
+    int index(int i, int j) const { return (j - y0) * width + (i - x0); }
+
+    // writes the auxiliary buffers as viewable images, prefix_albedo.ppm and so on
+    bool writeAOVs(const std::string &prefix) const
+    {
+        double max_depth = 0, max_variance = 0;
+        for (size_t k = 0; k < depth.size(); k++)
+        {
+            max_depth = fmax(max_depth, depth[k]);
+            max_variance = fmax(max_variance, variance[k]);
+        }
+        std::vector<Color> normals(normal.size()), depths(depth.size()), variances(variance.size());
+        for (size_t k = 0; k < normal.size(); k++)
+        {
+            normals[k] = 0.5 * (normal[k] + vec3(1, 1, 1));
+            auto d = max_depth > 0 ? depth[k] / max_depth : 0;
+            depths[k] = Color(d, d, d);
+            // square root to spread out the few very noisy pixels
+            auto v = max_variance > 0 ? sqrt(variance[k] / max_variance) : 0;
+            variances[k] = Color(v, v, v);
+        }
+        return writeImage(prefix + "_albedo.ppm", albedo) && writeImage(prefix + "_normal.ppm", normals) &&
+               writeImage(prefix + "_depth.ppm", depths) && writeImage(prefix + "_variance.ppm", variances);
+    }
+
+    // writes the costs as false color heatmaps, prefix_time.ppm and, when counted, prefix_nodes.ppm and
+    // prefix_tests.ppm. each is scaled to its 99th percentile, so a handful of outliers do not flatten the rest
+    bool writeCostMaps(const std::string &prefix, bool counted) const
+    {
+        bool written = writeHeatmap(prefix + "_time.ppm", seconds, 1e6, "us");
+        if (counted)
+        {
+            written = writeHeatmap(prefix + "_nodes.ppm", nodes, 1, "bvh nodes") && written;
+            written = writeHeatmap(prefix + "_tests.ppm", tests, 1, "primitive tests") && written;
+        }
+        return written;
+    }
+    bool writeHeatmap(const std::string &path, const std::vector<double> &values, double unit, const char *name) const
+    {
+        auto sorted = values;
+        auto top = sorted.begin() + static_cast<long>(0.99 * (sorted.size() - 1));
+        std::nth_element(sorted.begin(), top, sorted.end());
+        auto scale = *top > 0 ? *top : 1;
+        std::vector<Color> pixels(values.size());
+        double total = 0;
+        for (size_t k = 0; k < values.size(); k++)
+        {
+            pixels[k] = falseColor(values[k] / scale);
+            total += values[k];
+        }
+        std::clog << "\r" << path << ": mean " << unit * total / values.size() << ", white at " << unit * scale << " "
+                  << name << " per pixel\n";
+        return writeImage(path, pixels);
+    }
+
+    // plain ppm of values in [0, 1], no gamma since these are data and not radiance
+    bool writeImage(const std::string &path, const std::vector<Color> &pixels) const
+    {
+        std::ofstream out(path);
+        out << "P3\n"
+            << width << " " << height << "\n255\n";
+        static Interval intensity(0.000, 0.999);
+        for (const auto &p : pixels)
+        {
+            out << static_cast<int>(256 * intensity.clamp(p.x())) << ' '
+                << static_cast<int>(256 * intensity.clamp(p.y())) << ' '
+                << static_cast<int>(256 * intensity.clamp(p.z())) << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+};
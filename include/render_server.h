@@ -0,0 +1,272 @@
+#pragma once
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "camera.h"
+#include "distributed.h"
+#include "scene.h"
+
+// Long running render server on a local (unix domain) socket.
+// A render in its own process rebuilds the scene, decodes its textures and builds its bvh before tracing a single
+// ray. The server builds each named scene the first time a job asks for it and keeps it, so later jobs on that scene,
+// from whatever viewpoint, only trace. A job is one line of text per connection, the scene's name followed by the
+// camera settings it changes:
+//     cornell width=400 spp=64 from=278,278,-800 at=278,278,0 vfov=40 crop=0,0,200,200
+// (the settings are listed in applySetting)
+// and the answer is the image as a ppm, or a line starting with "error". "shutdown" stops the server.
+// Jobs queue up for a fixed pool of threads. Each job renders on one thread with its own copy of the scene's camera
+// and sampler, and builds its own material table and light set from the scene, which is only ever read (material
+// tables keep their lookups to themselves, see material_table.h). Jobs leave the process wide statistics (stats.h)
+// alone, any one of them resetting the counters would zero the others' mid render. Image sizes, sample counts and
+// depths are capped, so a client cannot have the server allocate or trace without bound.
+class RenderServer
+{
+public:
+    static const int max_size = 8192;  // pixels, either side of the image
+    static const int max_spp = 65536;
+    static const int max_depth = 1024; // rayColor recurses once per bounce
+    void addScene(const std::string &name, std::function<Scene()> build) { scenes[name].build = build; }
+
+    // applies one key=value camera setting of a job, false if it is not one. also used by the scene benchmark
+    static bool applySetting(Camera &camera, const std::string &setting)
+    {
+        auto equals = setting.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+        auto key = setting.substr(0, equals);
+        auto value = setting.substr(equals + 1);
+        if (key == "sampler")
+        {
+            return setSampler(camera, value);
+        }
+        double v[4];
+        int count = std::sscanf(value.c_str(), "%lf,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3]);
+        if (count == 1 && key == "width")
+            camera.img_width = static_cast<int>(v[0]);
+        else if (count == 1 && key == "aspect")
+            camera.aspect_ratio = v[0];
+        else if (count == 1 && key == "spp")
+            camera.samples_per_pixel = static_cast<int>(v[0]);
+        else if (count == 1 && key == "depth")
+            camera.max_depth = static_cast<int>(v[0]);
+        else if (count == 1 && key == "vfov")
+            camera.vfov = v[0];
+        else if (count == 1 && key == "defocus")
+            camera.defocus_angle = v[0];
+        else if (count == 1 && key == "focus")
+            camera.focus_distance = v[0];
+        else if (count == 3 && key == "from")
+            camera.lookFrom = Point3(v[0], v[1], v[2]);
+        else if (count == 3 && key == "at")
+            camera.lookAt = Point3(v[0], v[1], v[2]);
+        else if (count == 3 && key == "up")
+            camera.vup = vec3(v[0], v[1], v[2]);
+        else if (count == 1 && key == "denoise")
+            camera.denoise = v[0] != 0;
+        else if (count == 1 && key == "guiding")
+            camera.guiding = v[0] != 0;
+        else if (count == 1 && key == "caustics")
+            camera.caustics = v[0] != 0;
+        else if (count == 1 && key == "visibility")
+            camera.visibility_bins = v[0] != 0;
+        else if (count == 1 && key == "lights" && v[0] >= LIGHTS_NONE && v[0] <= LIGHTS_BVH)
+            camera.light_selection = static_cast<LightSelection>(static_cast<int>(v[0]));
+        else if (count == 4 && key == "crop")
+            camera.crop = Tile{static_cast<int32_t>(v[0]), static_cast<int32_t>(v[1]), static_cast<int32_t>(v[2]), static_cast<int32_t>(v[3])};
+        else
+            return false;
+        return camera.img_width > 0 && camera.img_width <= max_size && camera.aspect_ratio > 0 &&
+               camera.img_width / camera.aspect_ratio <= max_size && camera.samples_per_pixel > 0 &&
+               camera.samples_per_pixel <= max_spp && camera.max_depth <= max_depth;
+    }
+
+    static bool setSampler(Camera &camera, const std::string &name)
+    {
+        if (name == "independent")
+            camera.sampler = std::make_shared<IndependentSampler>();
+        else if (name == "stratified")
+            camera.sampler = std::make_shared<StratifiedSampler>();
+        else if (name == "halton")
+            camera.sampler = std::make_shared<HaltonSampler>();
+        else if (name == "sobol")
+            camera.sampler = std::make_shared<SobolSampler>();
+        else
+            return false;
+        return true;
+    }
+
+    // serves jobs at path until a shutdown request, false if the socket cannot be set up
+    bool serve(const std::string &path, int thread_count)
+    {
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (listen_fd < 0 || path.size() >= sizeof(address.sun_path))
+        {
+            std::clog << "Could not open a socket at " << path << '\n';
+            return false;
+        }
+        path.copy(address.sun_path, path.size());
+        unlink(path.c_str());
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(listen_fd, 64) != 0)
+        {
+            std::clog << "Could not listen on " << path << '\n';
+            close(listen_fd);
+            return false;
+        }
+        std::clog << "Serving renders on " << path << " with " << thread_count << " threads\n";
+
+        std::vector<std::thread> pool;
+        for (int t = 0; t < thread_count; t++)
+        {
+            pool.emplace_back([this]()
+                              { runJobs(); });
+        }
+        acceptJobs();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_ready.notify_all();
+        for (auto &thread : pool)
+        {
+            thread.join();
+        }
+        close(listen_fd);
+        unlink(path.c_str());
+        return true;
+    }
+
+private:
+    struct ResidentScene
+    {
+        std::function<Scene()> build;
+        std::once_flag built;
+        std::shared_ptr<Scene> scene;
+    };
+
+    std::map<std::string, ResidentScene> scenes; // names are fixed before serving, entries are never moved
+    int listen_fd = -1;
+    std::deque<int> queue; // connections waiting for a thread
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    bool stopping = false;
+
+    void acceptJobs()
+    {
+        while (true)
+        {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                queue.push_back(fd);
+            }
+            queue_ready.notify_one();
+        }
+    }
+
+    void runJobs()
+    {
+        while (true)
+        {
+            int fd;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_ready.wait(lock, [this]()
+                                 { return stopping || !queue.empty(); });
+                // queued jobs still get done on shutdown
+                if (queue.empty())
+                {
+                    return;
+                }
+                fd = queue.front();
+                queue.pop_front();
+            }
+            // read here rather than when accepting, so a slow client only holds up its own thread
+            auto request = readLine(fd);
+            if (request == "shutdown")
+            {
+                reply(fd, "ok\n");
+                // wakes acceptJobs up with an error
+                shutdown(listen_fd, SHUT_RDWR);
+                continue;
+            }
+            reply(fd, render(request));
+        }
+    }
+
+    // the job's image as a ppm, or an error line
+    std::string render(const std::string &request)
+    {
+        std::istringstream in(request);
+        std::string name;
+        in >> name;
+        auto found = scenes.find(name);
+        if (found == scenes.end())
+        {
+            return "error unknown scene '" + name + "'\n";
+        }
+        auto &resident = found->second;
+        // the first job on a scene builds it, any others on it wait for that
+        std::call_once(resident.built, [&]()
+                       { resident.scene = std::make_shared<Scene>(resident.build()); });
+
+        Camera camera = resident.scene->camera;
+        std::string setting;
+        while (in >> setting)
+        {
+            if (!applySetting(camera, setting))
+            {
+                return "error bad setting '" + setting + "'\n";
+            }
+        }
+        // jobs share no sampler state, and forking workers out of a threaded server is asking for trouble
+        camera.sampler = std::shared_ptr<Sampler>(camera.sampler->clone());
+        camera.workers = 0;
+        camera.statistics = false;
+        camera.progress = false;
+        std::ostringstream out;
+        camera.render(*resident.scene->world, out);
+        return out.str();
+    }
+
+    // a request line, without the newline. long lines are cut off, they are not valid jobs anyway
+    static std::string readLine(int fd)
+    {
+        std::string line;
+        char c;
+        while (line.size() < 4096 && receiveAll(fd, &c, 1) && c != '\n')
+        {
+            line += c;
+        }
+        return line;
+    }
+    static void reply(int fd, const std::string &text)
+    {
+        sendAll(fd, text.data(), text.size());
+        close(fd);
+    }
+};
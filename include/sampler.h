@@ -0,0 +1,268 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include "utilities.h"
+
+// Source of the random numbers a camera sample consumes.
+// Every camera sample (pixel i, j, sample s) is a point in a high dimensional space, one dimension per random decision
+// along its path: pixel offset, lens position, time, then a fixed block of dimensions per bounce.
+// Independent numbers clump and leave gaps in each of those, the samplers below spread each dimension (or pair of
+// dimensions) evenly over the samples of a pixel instead, which is where the noise reduction comes from.
+class Sampler
+{
+public:
+    // layout of the dimensions of one camera sample
+    static const int pixel_dimension = 0;  // 2D, offset inside the pixel
+    static const int lens_dimension = 2;   // 2D, defocus disk
+    static const int time_dimension = 4;   // 1D, shutter time
+    static const int camera_dimensions = 5;
+    // per bounce, a 2D direction and a 1D choice (reflect or refract etc) for the material,
+    // then a 1D light pick and a 2D point on that light for light sampling, then a 1D choice and a 2D direction
+    // for path guiding
+    static const int bounce_dimensions = 9;
+    static const int light_dimension = 3; // offset of the light sample inside a bounce's block
+    static const int guide_dimension = 6; // offset of the guiding sample
+
+    virtual ~Sampler() = default;
+
+    void setSamplesPerPixel(int spp) { samples_per_pixel = spp > 0 ? spp : 1; }
+    void setSeed(uint32_t _seed) { seed = _seed; }
+    uint32_t getSeed() const { return seed; }
+
+    // called once per camera sample, everything drawn afterwards belongs to that sample
+    void startPixelSample(int i, int j, int index)
+    {
+        pixel_seed = hash(hash(static_cast<uint32_t>(i) ^ hash(static_cast<uint32_t>(j))) ^ seed);
+        sample_index = index;
+        dimension = 0;
+    }
+    void setDimension(int dim) { dimension = dim; }
+    // jumps to the dimension block of a bounce, so bounce n always sees the same dimensions whatever came before it
+    void startBounce(int bounce) { dimension = camera_dimensions + bounce * bounce_dimensions; }
+    void startLightSample(int bounce) { dimension = camera_dimensions + bounce * bounce_dimensions + light_dimension; }
+    void startGuideSample(int bounce) { dimension = camera_dimensions + bounce * bounce_dimensions + guide_dimension; }
+
+    double get1D()
+    {
+        return sample1D(dimension++);
+    }
+    void get2D(double &u, double &v)
+    {
+        sample2D(dimension, u, v);
+        dimension += 2;
+    }
+
+    // independent copy for another render thread
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    // integer hash (lowbias32), used to decorrelate pixels and dimensions
+    static uint32_t hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+    static double toUnit(uint32_t x)
+    {
+        // top 32 bits to [0, 1)
+        return x * (1.0 / 4294967296.0);
+    }
+
+protected:
+    int samples_per_pixel = 1;
+    uint32_t seed = 0;
+    uint32_t pixel_seed = 0;
+    int sample_index = 0;
+    int dimension = 0;
+
+    virtual double sample1D(int dim) = 0;
+    virtual void sample2D(int dim, double &u, double &v)
+    {
+        u = sample1D(dim);
+        v = sample1D(dim + 1);
+    }
+
+    uint32_t dimensionSeed(int dim) const { return hash(pixel_seed ^ hash(static_cast<uint32_t>(dim) + 0x9e3779b9U)); }
+};
+
+// plain uniform random numbers, what the renderer always used
+class IndependentSampler : public Sampler
+{
+public:
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<IndependentSampler>(*this); }
+
+protected:
+    double sample1D(int dim) override { return randomDouble(); }
+};
+
+// jittered strata, each dimension of a pixel's samples gets one sample per stratum.
+// strata are shuffled per pixel and dimension so different dimensions do not line up
+class StratifiedSampler : public Sampler
+{
+public:
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<StratifiedSampler>(*this); }
+
+protected:
+    double sample1D(int dim) override
+    {
+        auto dim_seed = dimensionSeed(dim);
+        auto stratum = permute(sample_index % samples_per_pixel, samples_per_pixel, dim_seed);
+        return (stratum + jitter(dim_seed, 1)) / samples_per_pixel;
+    }
+    void sample2D(int dim, double &u, double &v) override
+    {
+        // closest grid to a square that fits in the sample count, leftover samples wrap around the grid
+        int nx = static_cast<int>(std::sqrt(static_cast<double>(samples_per_pixel)));
+        int ny = samples_per_pixel / nx;
+        auto dim_seed = dimensionSeed(dim);
+        auto stratum = permute(sample_index % (nx * ny), nx * ny, dim_seed);
+        u = (stratum % nx + jitter(dim_seed, 1)) / nx;
+        v = (stratum / nx + jitter(dim_seed, 2)) / ny;
+    }
+
+private:
+    double jitter(uint32_t dim_seed, uint32_t k) const
+    {
+        return toUnit(hash(dim_seed ^ hash(static_cast<uint32_t>(sample_index) * 3 + k)));
+    }
+    // random permutation of [0, n) evaluated at one index, by cycle walking a hash based bijection (Kensler)
+    static int permute(uint32_t i, uint32_t n, uint32_t p)
+    {
+        uint32_t w = n - 1;
+        w |= w >> 1;
+        w |= w >> 2;
+        w |= w >> 4;
+        w |= w >> 8;
+        w |= w >> 16;
+        do
+        {
+            i ^= p;
+            i *= 0xe170893d;
+            i ^= p >> 16;
+            i ^= (i & w) >> 4;
+            i ^= p >> 8;
+            i *= 0x0929eb3f;
+            i ^= p >> 23;
+            i ^= (i & w) >> 1;
+            i *= 1 | p >> 27;
+            i *= 0x6935fa69;
+            i ^= (i & w) >> 11;
+            i *= 0x74dcb303;
+            i ^= (i & w) >> 2;
+            i *= 0x9e501cc3;
+            i ^= (i & w) >> 2;
+            i *= 0xc860a3df;
+            i &= w;
+            i ^= i >> 5;
+        } while (i >= n);
+        return static_cast<int>((i + p) % n);
+    }
+};
+
+// Halton sequence, radical inverse in a different prime base per dimension.
+// each pixel gets a random toroidal shift (Cranley Patterson rotation) so neighbouring pixels do not share a pattern
+class HaltonSampler : public Sampler
+{
+public:
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<HaltonSampler>(*this); }
+
+protected:
+    double sample1D(int dim) override
+    {
+        static const int primes[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+                                     59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+                                     137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+                                     227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311};
+        const int prime_count = sizeof(primes) / sizeof(primes[0]);
+        auto shift = toUnit(dimensionSeed(dim));
+        if (dim >= prime_count)
+        {
+            // past the table high bases correlate badly anyway, fall back to hashed random numbers
+            return toUnit(hash(dimensionSeed(dim) ^ hash(static_cast<uint32_t>(sample_index))));
+        }
+        auto x = radicalInverse(sample_index, primes[dim]) + shift;
+        return x >= 1 ? x - 1 : x;
+    }
+
+private:
+    static double radicalInverse(uint32_t index, uint32_t base)
+    {
+        double inv_base = 1.0 / base;
+        double inv_base_n = 1.0;
+        uint64_t reversed = 0;
+        while (index > 0)
+        {
+            uint32_t next = index / base;
+            reversed = reversed * base + (index - next * base);
+            inv_base_n *= inv_base;
+            index = next;
+        }
+        return fmin(reversed * inv_base_n, 1.0 - 1e-16);
+    }
+};
+
+// Owen scrambled Sobol points, following Burley's "Practical Hash-based Owen Scrambling".
+// each 2D pair of dimensions uses the first two Sobol dimensions (well stratified together), with the sample order
+// shuffled and each coordinate scrambled by a seed unique to the pixel and dimension pair.
+class SobolSampler : public Sampler
+{
+public:
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<SobolSampler>(*this); }
+
+protected:
+    double sample1D(int dim) override
+    {
+        auto dim_seed = dimensionSeed(dim);
+        auto index = nestedUniformScramble(static_cast<uint32_t>(sample_index), dim_seed);
+        return toUnit(nestedUniformScramble(reverseBits(index), hash(dim_seed)));
+    }
+    void sample2D(int dim, double &u, double &v) override
+    {
+        auto dim_seed = dimensionSeed(dim);
+        auto index = nestedUniformScramble(static_cast<uint32_t>(sample_index), dim_seed);
+        u = toUnit(nestedUniformScramble(reverseBits(index), hash(dim_seed)));
+        v = toUnit(nestedUniformScramble(sobolSecond(index), hash(dim_seed + 1)));
+    }
+
+private:
+    static uint32_t reverseBits(uint32_t x)
+    {
+        x = ((x >> 1) & 0x55555555U) | ((x & 0x55555555U) << 1);
+        x = ((x >> 2) & 0x33333333U) | ((x & 0x33333333U) << 2);
+        x = ((x >> 4) & 0x0f0f0f0fU) | ((x & 0x0f0f0f0fU) << 4);
+        x = ((x >> 8) & 0x00ff00ffU) | ((x & 0x00ff00ffU) << 8);
+        return (x >> 16) | (x << 16);
+    }
+    // second Sobol dimension, direction numbers v_k = v_{k-1} ^ (v_{k-1} >> 1)
+    static uint32_t sobolSecond(uint32_t index)
+    {
+        uint32_t result = 0;
+        uint32_t direction = 0x80000000U;
+        for (; index != 0; index >>= 1)
+        {
+            if (index & 1)
+            {
+                result ^= direction;
+            }
+            direction ^= direction >> 1;
+        }
+        return result;
+    }
+    static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+    {
+        x += seed;
+        x ^= x * 0x6c50b47cU;
+        x ^= x * 0xb82f1e52U;
+        x ^= x * 0xc7afe638U;
+        x ^= x * 0x8d22f6e6U;
+        return x;
+    }
+    static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+    {
+        return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+    }
+};
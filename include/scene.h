@@ -0,0 +1,12 @@
+#pragma once
+#include <memory>
+#include "hittable.h"
+#include "camera.h"
+
+// a built world plus the camera it is meant to be viewed with
+// keeps scene construction separate from rendering so a scene can be cached, reused or rendered differently
+struct Scene
+{
+    std::shared_ptr<Hittable> world;
+    Camera camera;
+};
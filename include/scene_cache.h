@@ -0,0 +1,862 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "aabb.h"
+#include "bvh_node.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_array.h"
+#include "material.h"
+#include "quad.h"
+#include "sphere.h"
+#include "texture.h"
+
+// Binary scene cache.
+// The file is a header followed by flat arrays of plain records (textures, materials, primitives, bvh nodes, strings).
+// Everything refers to everything else by index or byte offset, never by pointer, so a mapped file is usable as is:
+// loading is an mmap plus a bounds check, and the bvh is traversed directly out of the mapping.
+// Only materials and textures are rebuilt as objects on load, since shading still goes through them.
+// Bump the version whenever a record layout changes, old caches are then rejected and rebuilt. A cache also carries
+// a fingerprint of what built the scene, the caller's choice (sceneFingerprint), and is rejected when the caller's
+// fingerprint differs, so a changed scene does not keep loading from an old cache.
+
+const char scene_cache_magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+const uint32_t scene_cache_version = 2;
+
+// 64 bit FNV-1a of text, say the build time of the code with the scene's builder in it
+inline uint64_t sceneFingerprint(const std::string &text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : text)
+    {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+enum CachedTextureType : uint32_t
+{
+    CACHED_SOLID,
+    CACHED_CHECKER,
+    CACHED_IMAGE,
+    CACHED_NOISE
+};
+
+enum CachedMaterialType : uint32_t
+{
+    CACHED_LAMBERTIAN,
+    CACHED_METAL,
+    CACHED_DIELECTRIC,
+    CACHED_DIFFUSE_LIGHT,
+    CACHED_ISOTROPIC
+};
+
+enum CachedPrimitiveType : uint32_t
+{
+    CACHED_SPHERE,
+    CACHED_MOVING_SPHERE,
+    CACHED_QUAD
+};
+
+struct CachedCamera
+{
+    double aspect_ratio;
+    double vfov;
+    double look_from[3];
+    double look_at[3];
+    double vup[3];
+    double defocus_angle;
+    double focus_distance;
+    double background[3];
+    int32_t img_width;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t padding;
+};
+
+struct CachedTexture
+{
+    uint32_t type;
+    int32_t even; // checker children, texture indices
+    int32_t odd;
+    uint32_t name_offset; // image file name, offset into the string section
+    double scale;         // checker scale or noise frequency
+    double color[3];
+};
+
+struct CachedMaterial
+{
+    uint32_t type;
+    int32_t texture; // -1 for materials with a plain color
+    double albedo[3];
+    double param; // fuzz for metal, refractive index for dielectric
+};
+
+struct CachedPrimitive
+{
+    uint32_t type;
+    int32_t material;
+    // sphere : p is the start center, a the center delta
+    // quad : p is the corner, a and b the edges, n and w the precomputed plane terms
+    double p[3];
+    double a[3];
+    double b[3];
+    double n[3];
+    double w[3];
+    double radius; // sphere radius or quad plane constant D
+};
+
+struct CachedNode
+{
+    double min[3];
+    double max[3];
+    // leaf : first primitive and primitive count
+    // interior : right child index (left child is always the next node), count is 0
+    uint32_t offset;
+    uint16_t count;
+    uint16_t axis;
+};
+
+struct SceneCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t fingerprint; // of the scene's builder, see sceneFingerprint
+    // each section is a byte offset from the start of the file plus an element count
+    uint64_t textures_offset, texture_count;
+    uint64_t materials_offset, material_count;
+    uint64_t primitives_offset, primitive_count;
+    uint64_t nodes_offset, node_count;
+    uint64_t strings_offset, strings_size;
+    CachedCamera camera;
+};
+
+inline void storeVec(double dst[3], const vec3 &v)
+{
+    dst[0] = v[0];
+    dst[1] = v[1];
+    dst[2] = v[2];
+}
+inline vec3 loadVec(const double src[3])
+{
+    return vec3(src[0], src[1], src[2]);
+}
+
+class SceneCacheWriter
+{
+public:
+    // flattens world into the cache format, fails (and writes nothing) on objects the format cannot describe
+    bool write(const std::string &path, const Hittable &world, const Camera &camera, uint64_t fingerprint = 0)
+    {
+        if (!flatten(world))
+        {
+            return false;
+        }
+        if (primitives.empty())
+        {
+            return false;
+        }
+        std::vector<AABB> boxes;
+        boxes.reserve(primitives.size());
+        for (const auto &prim : primitives)
+        {
+            boxes.push_back(primitiveBox(prim));
+        }
+        std::vector<int> order(primitives.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            order[i] = static_cast<int>(i);
+        }
+        buildNode(order, boxes, 0, static_cast<int>(order.size()));
+        // leaves refer to ranges in the reordered primitive list
+        std::vector<CachedPrimitive> sorted;
+        sorted.reserve(order.size());
+        for (int index : order)
+        {
+            sorted.push_back(primitives[index]);
+        }
+
+        SceneCacheHeader header = {};
+        std::memcpy(header.magic, scene_cache_magic, sizeof(header.magic));
+        header.version = scene_cache_version;
+        header.header_size = sizeof(SceneCacheHeader);
+        header.fingerprint = fingerprint;
+        uint64_t offset = align(sizeof(SceneCacheHeader));
+        header.textures_offset = offset;
+        header.texture_count = textures.size();
+        offset = align(offset + textures.size() * sizeof(CachedTexture));
+        header.materials_offset = offset;
+        header.material_count = materials.size();
+        offset = align(offset + materials.size() * sizeof(CachedMaterial));
+        header.primitives_offset = offset;
+        header.primitive_count = sorted.size();
+        offset = align(offset + sorted.size() * sizeof(CachedPrimitive));
+        header.nodes_offset = offset;
+        header.node_count = nodes.size();
+        offset = align(offset + nodes.size() * sizeof(CachedNode));
+        header.strings_offset = offset;
+        header.strings_size = strings.size();
+        header.file_size = offset + strings.size();
+        storeCamera(header.camera, camera);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        std::vector<char> file(header.file_size, 0);
+        std::memcpy(file.data(), &header, sizeof(header));
+        copySection(file, header.textures_offset, textures);
+        copySection(file, header.materials_offset, materials);
+        copySection(file, header.primitives_offset, sorted);
+        copySection(file, header.nodes_offset, nodes);
+        copySection(file, header.strings_offset, strings);
+        out.write(file.data(), file.size());
+        return static_cast<bool>(out);
+    }
+
+private:
+    std::vector<CachedTexture> textures;
+    std::vector<CachedMaterial> materials;
+    std::vector<CachedPrimitive> primitives;
+    std::vector<CachedNode> nodes;
+    std::vector<char> strings;
+    std::unordered_map<const Texture *, int> texture_ids;
+    std::unordered_map<const Material *, int> material_ids;
+
+    static uint64_t align(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+    template <typename T>
+    static void copySection(std::vector<char> &file, uint64_t offset, const std::vector<T> &section)
+    {
+        if (!section.empty())
+        {
+            std::memcpy(file.data() + offset, section.data(), section.size() * sizeof(T));
+        }
+    }
+
+    static void storeCamera(CachedCamera &dst, const Camera &camera)
+    {
+        dst.aspect_ratio = camera.aspect_ratio;
+        dst.vfov = camera.vfov;
+        storeVec(dst.look_from, camera.lookFrom);
+        storeVec(dst.look_at, camera.lookAt);
+        storeVec(dst.vup, camera.vup);
+        dst.defocus_angle = camera.defocus_angle;
+        dst.focus_distance = camera.focus_distance;
+        storeVec(dst.background, camera.background);
+        dst.img_width = camera.img_width;
+        dst.samples_per_pixel = camera.samples_per_pixel;
+        dst.max_depth = camera.max_depth;
+    }
+
+    bool flatten(const Hittable &object)
+    {
+        // containers are unrolled, the cache builds its own bvh over the leaves
+        if (auto array = dynamic_cast<const HittableArray *>(&object))
+        {
+            for (const auto &child : array->objects)
+            {
+                if (!flatten(*child))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (auto node = dynamic_cast<const BVHNode *>(&object))
+        {
+            if (!flatten(*node->leftChild()))
+            {
+                return false;
+            }
+            return node->leftChild() == node->rightChild() || flatten(*node->rightChild());
+        }
+        if (auto sphere = dynamic_cast<const Sphere *>(&object))
+        {
+            CachedPrimitive prim = {};
+            prim.type = sphere->isMoving() ? CACHED_MOVING_SPHERE : CACHED_SPHERE;
+            prim.material = addMaterial(sphere->material());
+            storeVec(prim.p, sphere->centerStart());
+            storeVec(prim.a, sphere->centerDelta());
+            prim.radius = sphere->getRadius();
+            primitives.push_back(prim);
+            return prim.material >= 0;
+        }
+        // derived quad shapes change isInterior, so only exact quads are stored
+        if (typeid(object) == typeid(Quad))
+        {
+            auto quad = static_cast<const Quad *>(&object);
+            CachedPrimitive prim = {};
+            prim.type = CACHED_QUAD;
+            prim.material = addMaterial(quad->material());
+            auto u = quad->edgeU();
+            auto normal = u.cross(quad->edgeV());
+            auto n = normalize(normal);
+            storeVec(prim.p, quad->origin());
+            storeVec(prim.a, u);
+            storeVec(prim.b, quad->edgeV());
+            storeVec(prim.n, n);
+            storeVec(prim.w, normal / normal.dot(normal));
+            prim.radius = n.dot(quad->origin());
+            primitives.push_back(prim);
+            return prim.material >= 0;
+        }
+        std::clog << "Scene cache : unsupported object " << typeid(object).name() << '\n';
+        return false;
+    }
+
+    int addTexture(const std::shared_ptr<Texture> &texture)
+    {
+        auto found = texture_ids.find(texture.get());
+        if (found != texture_ids.end())
+        {
+            return found->second;
+        }
+        CachedTexture record = {};
+        if (auto checker = std::dynamic_pointer_cast<CheckerTexture>(texture))
+        {
+            // children go first, so loading in order always finds them already built
+            record.type = CACHED_CHECKER;
+            record.even = addTexture(checker->evenTexture());
+            record.odd = addTexture(checker->oddTexture());
+            record.scale = checker->scale();
+            if (record.even < 0 || record.odd < 0)
+            {
+                return -1;
+            }
+        }
+        else if (auto image = std::dynamic_pointer_cast<ImageTexture>(texture))
+        {
+            record.type = CACHED_IMAGE;
+            record.name_offset = static_cast<uint32_t>(strings.size());
+            strings.insert(strings.end(), image->fileName().begin(), image->fileName().end());
+            strings.push_back('\0');
+        }
+        else if (auto noise = std::dynamic_pointer_cast<NoiseTexture>(texture))
+        {
+            // the permutation tables are regenerated on load, only the frequency is kept
+            record.type = CACHED_NOISE;
+            record.scale = noise->noiseFrequency();
+        }
+        else if (std::dynamic_pointer_cast<SolidColor>(texture))
+        {
+            record.type = CACHED_SOLID;
+            storeVec(record.color, texture->value(0, 0, Point3()));
+        }
+        else
+        {
+            std::clog << "Scene cache : unsupported texture " << typeid(*texture).name() << '\n';
+            return -1;
+        }
+        int id = static_cast<int>(textures.size());
+        textures.push_back(record);
+        texture_ids[texture.get()] = id;
+        return id;
+    }
+
+    int addMaterial(const std::shared_ptr<Material> &material)
+    {
+        auto found = material_ids.find(material.get());
+        if (found != material_ids.end())
+        {
+            return found->second;
+        }
+        CachedMaterial record = {};
+        record.texture = -1;
+        if (auto lambertian = std::dynamic_pointer_cast<Lambertian>(material))
+        {
+            record.type = CACHED_LAMBERTIAN;
+            record.texture = addTexture(lambertian->texture());
+        }
+        else if (auto metal = std::dynamic_pointer_cast<Metal>(material))
+        {
+            record.type = CACHED_METAL;
+            storeVec(record.albedo, metal->color());
+            record.param = metal->fuzziness();
+        }
+        else if (auto dielectric = std::dynamic_pointer_cast<Dielectric>(material))
+        {
+            record.type = CACHED_DIELECTRIC;
+            record.param = dielectric->refractiveIndex();
+        }
+        else if (auto light = std::dynamic_pointer_cast<DiffuseLight>(material))
+        {
+            record.type = CACHED_DIFFUSE_LIGHT;
+            record.texture = addTexture(light->texture());
+        }
+        else if (auto isotropic = std::dynamic_pointer_cast<Isotropic>(material))
+        {
+            record.type = CACHED_ISOTROPIC;
+            record.texture = addTexture(isotropic->texture());
+        }
+        else
+        {
+            std::clog << "Scene cache : unsupported material " << typeid(*material).name() << '\n';
+            return -1;
+        }
+        if (record.type != CACHED_METAL && record.type != CACHED_DIELECTRIC && record.texture < 0)
+        {
+            return -1;
+        }
+        int id = static_cast<int>(materials.size());
+        materials.push_back(record);
+        material_ids[material.get()] = id;
+        return id;
+    }
+
+    static AABB primitiveBox(const CachedPrimitive &prim)
+    {
+        if (prim.type == CACHED_QUAD)
+        {
+            auto O = loadVec(prim.p);
+            auto u = loadVec(prim.a);
+            auto v = loadVec(prim.b);
+            return AABB(AABB(O, O + u + v), AABB(O + u, O + v)).pad();
+        }
+        auto radius_vector = vec3(prim.radius, prim.radius, prim.radius);
+        auto center = loadVec(prim.p);
+        AABB box(center - radius_vector, center + radius_vector);
+        // moving spheres are bounded over their whole path
+        return AABB(box, box + loadVec(prim.a));
+    }
+
+    int buildNode(std::vector<int> &order, const std::vector<AABB> &boxes, int start, int end)
+    {
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(CachedNode());
+        AABB bounds = boxes[order[start]];
+        AABB centroids(centroid(bounds), centroid(bounds));
+        for (int i = start + 1; i < end; i++)
+        {
+            bounds = AABB(bounds, boxes[order[i]]);
+            auto c = centroid(boxes[order[i]]);
+            centroids = AABB(centroids, AABB(c, c));
+        }
+        CachedNode node = {};
+        storeVec(node.min, Point3(bounds.x.min, bounds.y.min, bounds.z.min));
+        storeVec(node.max, Point3(bounds.x.max, bounds.y.max, bounds.z.max));
+
+        int size = end - start;
+        if (size <= 2)
+        {
+            node.offset = start;
+            node.count = static_cast<uint16_t>(size);
+            nodes[index] = node;
+            return index;
+        }
+        // median split along the axis the centroids spread the most on
+        int axis = 0;
+        for (int i = 1; i < 3; i++)
+        {
+            if (centroids.getAxis(i).size() > centroids.getAxis(axis).size())
+            {
+                axis = i;
+            }
+        }
+        int mid = start + size / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b)
+                         { return centroid(boxes[a])[axis] < centroid(boxes[b])[axis]; });
+        buildNode(order, boxes, start, mid);
+        node.offset = buildNode(order, boxes, mid, end);
+        node.axis = static_cast<uint16_t>(axis);
+        nodes[index] = node;
+        return index;
+    }
+
+    static Point3 centroid(AABB box)
+    {
+        return Point3(box.x.min + box.x.size() / 2, box.y.min + box.y.size() / 2, box.z.min + box.z.size() / 2);
+    }
+};
+
+class MappedScene : public Hittable
+{
+public:
+    // fingerprint has to be the one the cache was written with
+    MappedScene(const std::string &path, uint64_t _fingerprint = 0) : mapping(nullptr), mapping_size(0), fingerprint(_fingerprint)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SceneCacheHeader)))
+        {
+            void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address != MAP_FAILED)
+            {
+                mapping = static_cast<const char *>(address);
+                mapping_size = st.st_size;
+            }
+        }
+        close(fd);
+        if (mapping != nullptr && !attach())
+        {
+            std::clog << "Scene cache " << path << " is stale or corrupt, ignoring it\n";
+            unmap();
+        }
+    }
+    ~MappedScene() { unmap(); }
+    MappedScene(const MappedScene &) = delete;
+    MappedScene &operator=(const MappedScene &) = delete;
+
+    bool valid() const { return mapping != nullptr; }
+
+    Camera camera() const
+    {
+        const CachedCamera &c = header->camera;
+        return Camera(c.aspect_ratio, c.img_width, c.samples_per_pixel, c.max_depth, c.vfov,
+                      loadVec(c.look_from), loadVec(c.look_at), loadVec(c.vup),
+                      c.defocus_angle, c.focus_distance, loadVec(c.background));
+    }
+
+    AABB boundingBox() const override { return bbox; }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        for (const auto &material : material_table)
+        {
+            visit(material);
+        }
+    }
+    void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const override
+    {
+        for (const auto &emitter : emitters)
+        {
+            emitter->visitLights(visit);
+        }
+    }
+
+    bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
+    {
+        // iterative traversal straight out of the mapping, near child first
+        // median splits keep the depth at log2 of the primitive count, attach() rejects trees too deep for the stack
+        uint32_t stack[max_tree_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+        bool negative[3] = {ray.direction()[0] < 0, ray.direction()[1] < 0, ray.direction()[2] < 0};
+        while (true)
+        {
+            const CachedNode &node = nodes[current];
+            if (nodeHit(node, ray, t_limits))
+            {
+                if (node.count > 0)
+                {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; i++)
+                    {
+                        if (primitiveHit(primitives[i], ray, t_limits, info))
+                        {
+                            hit_anything = true;
+                            t_limits.max = info.t;
+                        }
+                    }
+                }
+                else
+                {
+                    uint32_t left = current + 1;
+                    uint32_t right = node.offset;
+                    if (negative[node.axis])
+                    {
+                        std::swap(left, right);
+                    }
+                    stack[stack_size++] = right;
+                    current = left;
+                    continue;
+                }
+            }
+            if (stack_size == 0)
+            {
+                break;
+            }
+            current = stack[--stack_size];
+        }
+        return hit_anything;
+    }
+
+private:
+    // a node at depth d has at most d - 1 far children waiting on the traversal stack
+    static const int max_tree_depth = 64;
+    const char *mapping;
+    size_t mapping_size;
+    uint64_t fingerprint;
+    const SceneCacheHeader *header;
+    const CachedTexture *textures;
+    const CachedMaterial *cached_materials;
+    const CachedPrimitive *primitives;
+    const CachedNode *nodes;
+    const char *strings;
+    std::vector<std::shared_ptr<Texture>> texture_table;
+    std::vector<std::shared_ptr<Material>> material_table;
+    // emissive primitives rebuilt as objects, which light sampling needs (area, sampling, pdfs). a hit on one reports
+    // that object, so lights and the paths that run into them agree on which light it was
+    std::vector<std::shared_ptr<Hittable>> emitters;
+    std::vector<const Hittable *> emitter_of; // per primitive, null for the rest
+    AABB bbox;
+
+    void unmap()
+    {
+        if (mapping != nullptr)
+        {
+            munmap(const_cast<char *>(mapping), mapping_size);
+            mapping = nullptr;
+        }
+    }
+
+    bool sectionFits(uint64_t offset, uint64_t count, uint64_t size) const
+    {
+        return offset % 8 == 0 && offset <= mapping_size && count <= (mapping_size - offset) / size;
+    }
+
+    bool attach()
+    {
+        header = reinterpret_cast<const SceneCacheHeader *>(mapping);
+        if (std::memcmp(header->magic, scene_cache_magic, sizeof(header->magic)) != 0 ||
+            header->version != scene_cache_version || header->header_size != sizeof(SceneCacheHeader) ||
+            header->file_size != mapping_size || header->fingerprint != fingerprint)
+        {
+            return false;
+        }
+        if (!sectionFits(header->textures_offset, header->texture_count, sizeof(CachedTexture)) ||
+            !sectionFits(header->materials_offset, header->material_count, sizeof(CachedMaterial)) ||
+            !sectionFits(header->primitives_offset, header->primitive_count, sizeof(CachedPrimitive)) ||
+            !sectionFits(header->nodes_offset, header->node_count, sizeof(CachedNode)) ||
+            header->strings_offset + header->strings_size > mapping_size || header->node_count == 0)
+        {
+            return false;
+        }
+        textures = reinterpret_cast<const CachedTexture *>(mapping + header->textures_offset);
+        cached_materials = reinterpret_cast<const CachedMaterial *>(mapping + header->materials_offset);
+        primitives = reinterpret_cast<const CachedPrimitive *>(mapping + header->primitives_offset);
+        nodes = reinterpret_cast<const CachedNode *>(mapping + header->nodes_offset);
+        strings = mapping + header->strings_offset;
+        bbox = AABB(loadVec(nodes[0].min), loadVec(nodes[0].max));
+        if (!buildMaterials() || !indicesValid())
+        {
+            return false;
+        }
+        buildEmitters();
+        return true;
+    }
+
+    void buildEmitters()
+    {
+        emitter_of.assign(header->primitive_count, nullptr);
+        for (uint64_t i = 0; i < header->primitive_count; i++)
+        {
+            const CachedPrimitive &prim = primitives[i];
+            const auto &material = material_table[prim.material];
+            if (!material->emits())
+            {
+                continue;
+            }
+            std::shared_ptr<Hittable> emitter;
+            if (prim.type == CACHED_QUAD)
+            {
+                emitter = std::make_shared<Quad>(loadVec(prim.p), loadVec(prim.a), loadVec(prim.b), material);
+            }
+            else if (prim.type == CACHED_MOVING_SPHERE)
+            {
+                emitter = std::make_shared<Sphere>(loadVec(prim.p), loadVec(prim.p) + loadVec(prim.a), prim.radius, material);
+            }
+            else
+            {
+                emitter = std::make_shared<Sphere>(loadVec(prim.p), prim.radius, material);
+            }
+            emitter_of[i] = emitter.get();
+            emitters.push_back(emitter);
+        }
+    }
+
+    bool indicesValid() const
+    {
+        for (uint64_t i = 0; i < header->primitive_count; i++)
+        {
+            if (primitives[i].material < 0 || primitives[i].material >= static_cast<int64_t>(material_table.size()))
+            {
+                return false;
+            }
+        }
+        // children always come after their parent, so every node's depth is known by the time it is reached
+        std::vector<int> depths(header->node_count, 0);
+        depths[0] = 1;
+        for (uint64_t i = 0; i < header->node_count; i++)
+        {
+            const CachedNode &node = nodes[i];
+            bool bad_leaf = node.count > 0 && node.offset + uint64_t(node.count) > header->primitive_count;
+            bool bad_interior = node.count == 0 && (node.offset <= i || node.offset >= header->node_count || node.axis > 2);
+            if (bad_leaf || bad_interior || depths[i] > max_tree_depth)
+            {
+                return false;
+            }
+            if (node.count == 0 && depths[i] > 0)
+            {
+                depths[i + 1] = std::max(depths[i + 1], depths[i] + 1);
+                depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+            }
+        }
+        return true;
+    }
+
+    bool buildMaterials()
+    {
+        // textures only refer backwards, see SceneCacheWriter::addTexture
+        for (uint64_t i = 0; i < header->texture_count; i++)
+        {
+            const CachedTexture &t = textures[i];
+            std::shared_ptr<Texture> texture;
+            switch (t.type)
+            {
+            case CACHED_SOLID:
+                texture = std::make_shared<SolidColor>(loadVec(t.color));
+                break;
+            case CACHED_CHECKER:
+                if (t.even < 0 || t.odd < 0 || t.even >= static_cast<int64_t>(i) || t.odd >= static_cast<int64_t>(i))
+                {
+                    return false;
+                }
+                texture = std::make_shared<CheckerTexture>(t.scale, texture_table[t.even], texture_table[t.odd]);
+                break;
+            case CACHED_IMAGE:
+                if (t.name_offset >= header->strings_size ||
+                    std::memchr(strings + t.name_offset, '\0', header->strings_size - t.name_offset) == nullptr)
+                {
+                    return false;
+                }
+                texture = std::make_shared<ImageTexture>(strings + t.name_offset);
+                break;
+            case CACHED_NOISE:
+                texture = std::make_shared<NoiseTexture>(t.scale);
+                break;
+            default:
+                return false;
+            }
+            texture_table.push_back(texture);
+        }
+        for (uint64_t i = 0; i < header->material_count; i++)
+        {
+            const CachedMaterial &m = cached_materials[i];
+            bool needs_texture = m.type != CACHED_METAL && m.type != CACHED_DIELECTRIC;
+            if (needs_texture && (m.texture < 0 || m.texture >= static_cast<int64_t>(texture_table.size())))
+            {
+                return false;
+            }
+            std::shared_ptr<Material> material;
+            switch (m.type)
+            {
+            case CACHED_LAMBERTIAN:
+                material = std::make_shared<Lambertian>(texture_table[m.texture]);
+                break;
+            case CACHED_METAL:
+                material = std::make_shared<Metal>(loadVec(m.albedo), m.param);
+                break;
+            case CACHED_DIELECTRIC:
+                material = std::make_shared<Dielectric>(m.param);
+                break;
+            case CACHED_DIFFUSE_LIGHT:
+                material = std::make_shared<DiffuseLight>(texture_table[m.texture]);
+                break;
+            case CACHED_ISOTROPIC:
+                material = std::make_shared<Isotropic>(texture_table[m.texture]);
+                break;
+            default:
+                return false;
+            }
+            material_table.push_back(material);
+        }
+        return true;
+    }
+
+    static bool nodeHit(const CachedNode &node, const Ray &ray, Interval r_t)
+    {
+        RT_STAT(STAT_BVH_NODES);
+        RT_STAT(STAT_AABB_TESTS);
+        // same slab test as AABB::hit, without building intervals
+        for (int i = 0; i < 3; i++)
+        {
+            auto b_i = 1 / ray.direction()[i];
+            auto A_i = ray.origin()[i];
+            auto t0 = (node.min[i] - A_i) * b_i;
+            auto t1 = (node.max[i] - A_i) * b_i;
+            if (b_i < 0)
+            {
+                std::swap(t0, t1);
+            }
+            if (t0 > r_t.min)
+                r_t.min = t0;
+            if (t1 < r_t.max)
+                r_t.max = t1;
+            if (r_t.max <= r_t.min)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool primitiveHit(const CachedPrimitive &prim, const Ray &ray, Interval t_limits, hit_info &info) const
+    {
+        if (prim.type == CACHED_QUAD)
+        {
+            RT_STAT(STAT_QUAD_TESTS);
+            // same plane and alpha beta test as Quad::hit
+            auto n = loadVec(prim.n);
+            auto denom = ray.direction().dot(n);
+            if (fabs(denom) < 1e-8)
+            {
+                return false;
+            }
+            auto t = (prim.radius - ray.origin().dot(n)) / denom;
+            if (!t_limits.contains(t))
+            {
+                return false;
+            }
+            auto poi = ray.at(t);
+            vec3 hit_vec = poi - loadVec(prim.p);
+            auto w = loadVec(prim.w);
+            auto alpha = (hit_vec.cross(loadVec(prim.b))).dot(w);
+            auto beta = (-hit_vec.cross(loadVec(prim.a))).dot(w);
+            if (alpha > 1 || alpha < 0 || beta < 0 || beta > 1)
+            {
+                return false;
+            }
+            info.u = alpha;
+            info.v = beta;
+            info.t = t;
+            info.p = poi;
+            info.setNormalFace(ray, n);
+        }
+        else
+        {
+            auto center = loadVec(prim.p);
+            if (prim.type == CACHED_MOVING_SPHERE)
+            {
+                center += ray.time() * loadVec(prim.a);
+            }
+            if (!Sphere::hitSphere(center, prim.radius, ray, t_limits, info))
+            {
+                return false;
+            }
+        }
+        info.mat = material_table[prim.material].get();
+        auto emitter = emitter_of[&prim - primitives];
+        info.object = emitter != nullptr ? emitter : this;
+        return true;
+    }
+};
@@ -0,0 +1,470 @@
+#pragma once
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "bvh_node.h"
+#include "camera.h"
+#include "environment.h"
+#include "hittable_array.h"
+#include "perlin.h"
+#include "quad.h"
+#include "scene.h"
+#include "sphere.h"
+#include "texture.h"
+#include "volume.h"
+
+// The built in scenes, shared by the renderer, the render server and the benchmarks.
+
+inline Scene finalBookOneScene()
+{
+    HittableArray world;
+
+    // materials and geometries are decoupled, have fun here
+    // this sets up the final render in book1, change according to your scene
+    auto checker = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+
+    for (int a = -11; a < 11; a++)
+    {
+        for (int b = -11; b < 11; b++)
+        {
+            auto choose_mat = randomDouble();
+            Point3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
+
+            if ((center - Point3(4, 0.2, 0)).length() > 0.9)
+            {
+                std::shared_ptr<Material> sphere_material;
+
+                if (choose_mat < 0.8)
+                {
+                    // diffuse
+                    auto albedo = Color::random() * Color::random();
+                    sphere_material = std::make_shared<Lambertian>(albedo);
+                    Point3 center_end = center + vec3(0, randomDouble(0, 0.5), 0);
+                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95)
+                {
+                    // metal
+                    auto albedo = Color::random(0.5, 1);
+                    auto fuzz = randomDouble(0, 0.5);
+                    sphere_material = std::make_shared<Metal>(albedo, fuzz);
+                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+                else
+                {
+                    // glass
+                    sphere_material = std::make_shared<Dielectric>(1.5);
+                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = std::make_shared<Dielectric>(1.5);
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
+    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
+    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
+
+    world = HittableArray(std::make_shared<BVHNode>(world));
+
+    double aspect_ratio;   // imagewidth / imageheight
+    int img_width;         // Rendered image width in pixel count
+    int samples_per_pixel; // Count of random samples for each pixel, keep low for lower quality render
+    int max_depth;         // Maximum number of ray bounces into scene, keep low for low performance hardware and faster render time, can segfault
+    double vfov;           // Vertical view angle (field of view)
+    Point3 lookFrom;       // Point camera is looking from
+    Point3 lookAt;         // Point camera is looking at
+    vec3 vup;              // Camera-relative "up" direction
+    double defocus_angle;  // Variation angle of rays through each pixel
+    double focus_distance; // Distance from camera lookfrom point to plane of perfect focus
+
+    // Use this constructor after filling above values accordingly for different renders and comment out default
+    // Camera camera = Camera(aspect_ratio, img_width, samples_per_pixel, max_depth, vfov, lookFrom, lookAt, vup, defocus_angle, focus_distance)
+
+    // or use the default render
+    // Camera camera = Camera();
+
+    // for final render
+    Camera camera = Camera(16.0 / 9.0, 400, 400, 100, 20.0, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0.6, 10.0, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+
+inline Scene twoSpheres()
+{
+    HittableArray world;
+
+    auto checker = std::make_shared<CheckerTexture>(0.8, Color(.2, .3, .1), Color(.9, .9, .9));
+
+    world.add(std::make_shared<Sphere>(Point3(0, -10, 0), 10, std::make_shared<Lambertian>(checker)));
+    world.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
+
+    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene earth()
+{
+    auto earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
+    auto earth_surface = std::make_shared<Lambertian>(earth_texture);
+    auto globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
+    auto world = HittableArray(globe);
+
+    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(0, 0, 12), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+
+inline Scene perlinSphere()
+{
+    HittableArray world;
+
+    auto pertext = std::make_shared<NoiseTexture>(4);
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
+    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene quads()
+{
+    HittableArray world;
+
+    // Materials
+    auto left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
+    auto back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
+    auto right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
+    auto upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
+    auto lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
+
+    // Quads
+    world.add(std::make_shared<Quad>(Point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
+    world.add(std::make_shared<Quad>(Point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
+    world.add(std::make_shared<Quad>(Point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
+    world.add(std::make_shared<Quad>(Point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
+    world.add(std::make_shared<Quad>(Point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
+
+    Camera camera(1.0, 400, 100, 50, 80, Point3(0, 0, 9), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene simpleLight()
+{
+    HittableArray world;
+
+    auto pertext = std::make_shared<NoiseTexture>(4);
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
+    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
+
+    auto difflight = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(4, 4, 4)));
+    world.add(std::make_shared<Sphere>(Point3(0, 7, 0), 2, difflight));
+    world.add(std::make_shared<Quad>(Point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+
+    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(26, 3, 6), Point3(0, 2, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene cornellBox()
+{
+    HittableArray world;
+
+    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(15, 15, 15)));
+
+    world.add(std::make_shared<Quad>(Point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(std::make_shared<Quad>(Point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = std::make_shared<RotateY>(15, box1);
+    box1 = std::make_shared<Translate>(box1, vec3(265, 0, 295));
+    world.add(box1);
+
+    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = std::make_shared<RotateY>(-18, box2);
+    box2 = std::make_shared<Translate>(box2, vec3(130, 0, 65));
+    world.add(box2);
+
+    Camera camera(1.0, 600, 100, 50, 40, Point3(278, 278, -800), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene cornellSmoke()
+{
+    HittableArray world;
+
+    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(7, 7, 7)));
+
+    world.add(std::make_shared<Quad>(Point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(std::make_shared<Quad>(Point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+    world.add(std::make_shared<Quad>(Point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
+    box1 = std::make_shared<RotateY>(15, box1);
+    box1 = std::make_shared<Translate>(box1, vec3(265, 0, 295));
+
+    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
+    box2 = std::make_shared<RotateY>(-18, box2);
+    box2 = std::make_shared<Translate>(box2, vec3(130, 0, 65));
+
+    world.add(std::make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
+    world.add(std::make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
+
+    Camera camera(1.0, 600, 200, 50, 40, Point3(28, 278, -800), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene finalBookTwoScene()
+{
+    HittableArray boxes1;
+    auto ground = std::make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
+
+    int boxes_per_side = 20;
+    for (int i = 0; i < boxes_per_side; i++)
+    {
+        for (int j = 0; j < boxes_per_side; j++)
+        {
+            auto w = 100.0;
+            auto x0 = -1000.0 + i * w;
+            auto z0 = -1000.0 + j * w;
+            auto y0 = 0.0;
+            auto x1 = x0 + w;
+            auto y1 = randomDouble(1, 101);
+            auto z1 = z0 + w;
+
+            boxes1.add(box(Point3(x0, y0, z0), Point3(x1, y1, z1), ground));
+        }
+    }
+
+    HittableArray world;
+
+    world.add(std::make_shared<BVHNode>(boxes1));
+
+    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(7, 7, 7)));
+    world.add(std::make_shared<Quad>(Point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
+
+    auto center1 = Point3(400, 400, 200);
+    auto center2 = center1 + vec3(30, 0, 0);
+    auto sphere_material = std::make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
+    world.add(std::make_shared<Sphere>(center1, center2, 50, sphere_material));
+
+    world.add(std::make_shared<Sphere>(Point3(260, 150, 45), 50, std::make_shared<Dielectric>(1.5)));
+    world.add(std::make_shared<Sphere>(
+        Point3(0, 150, 145), 50, std::make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
+
+    auto boundary = std::make_shared<Sphere>(Point3(360, 150, 145), 70, std::make_shared<Dielectric>(1.5));
+    world.add(boundary);
+    world.add(std::make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+    boundary = std::make_shared<Sphere>(Point3(0, 0, 0), 5000, std::make_shared<Dielectric>(1.5));
+    world.add(std::make_shared<ConstantMedium>(boundary, .0001, Color(1, 1, 1)));
+
+    auto emat = std::make_shared<Lambertian>(std::make_shared<ImageTexture>("earthmap.jpg"));
+    world.add(std::make_shared<Sphere>(Point3(400, 200, 400), 100, emat));
+    auto pertext = std::make_shared<NoiseTexture>(0.1);
+    world.add(std::make_shared<Sphere>(Point3(220, 280, 300), 80, std::make_shared<Lambertian>(pertext)));
+
+    HittableArray boxes2;
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    int ns = 100;
+    for (int j = 0; j < ns; j++)
+    {
+        boxes2.add(std::make_shared<Sphere>(Point3::random(0, 165), 10, white));
+    }
+
+    world.add(std::make_shared<Translate>(
+        std::make_shared<RotateY>(15,
+                                  std::make_shared<BVHNode>(boxes2)),
+        vec3(-100, 270, 395)));
+
+    Camera camera(1.0, 400, 100, 4, 40, Point3(478, 278, -600), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene cornellCloud()
+{
+    HittableArray world;
+
+    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
+    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
+    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
+    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(7, 7, 7)));
+
+    world.add(std::make_shared<Quad>(Point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
+    world.add(std::make_shared<Quad>(Point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
+    world.add(std::make_shared<Quad>(Point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
+    world.add(std::make_shared<Quad>(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
+
+    // a turbulent blob of smoke in the middle of the box, most of the grid stays empty
+    auto center = Point3(278, 250, 278);
+    auto cloud = std::make_shared<SparseBrickGrid>(AABB(Point3(78, 50, 78), Point3(478, 450, 478)), 128, 128, 128);
+    Perlin noise;
+    cloud->fill([&](const Point3 &p)
+                {
+        auto falloff = 1 - (p - center).length() / 200;
+        auto shape = falloff + 0.6 * noise.turbulence(p * 0.02) - 0.5;
+        return shape > 0 ? 0.08 * shape : 0.0; });
+    world.add(std::make_shared<HeterogeneousMedium>(cloud, Color(0.8, 0.6, 0.4)));
+
+    Camera camera(1.0, 600, 200, 50, 40, Point3(278, 278, -800), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene movingBookOneScene()
+{
+    // motion blur stress test, a field of thousands of fast moving spheres
+    // their swept boxes overlap heavily, so this is where the time interpolated bvh bounds pay off
+    HittableArray world;
+
+    auto checker = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+
+    for (int a = -30; a < 30; a++)
+    {
+        for (int b = -30; b < 30; b++)
+        {
+            Point3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
+            Point3 center_end = center + vec3(randomDouble(-2, 2), randomDouble(0, 1), randomDouble(-2, 2));
+            std::shared_ptr<Material> sphere_material;
+            if (randomDouble() < 0.8)
+            {
+                sphere_material = std::make_shared<Lambertian>(Color::random() * Color::random());
+            }
+            else
+            {
+                sphere_material = std::make_shared<Metal>(Color::random(0.5, 1), randomDouble(0, 0.5));
+            }
+            world.add(std::make_shared<Sphere>(center, center_end, 0.2, sphere_material));
+        }
+    }
+
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, std::make_shared<Dielectric>(1.5)));
+    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+    world = HittableArray(std::make_shared<BVHNode>(world));
+
+    Camera camera = Camera(16.0 / 9.0, 400, 100, 50, 30.0, Point3(13, 4, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10.0, Color(0.7, 0.8, 1.0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+inline Scene manyLights()
+{
+    // light sampling stress test, a night scene lit only by thousands of small colored lamps
+    // bounces almost never find lights this small, and most of them are too far away to matter for any one point
+    HittableArray world;
+
+    auto ground = std::make_shared<Lambertian>(std::make_shared<CheckerTexture>(1.0, Color(.2, .2, .2), Color(.7, .7, .7)));
+    world.add(std::make_shared<Quad>(Point3(-40, 0, -40), vec3(80, 0, 0), vec3(0, 0, 80), ground));
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, std::make_shared<Lambertian>(Color(0.8, 0.8, 0.8))));
+    world.add(std::make_shared<Sphere>(Point3(-2.5, 1, -1), 1.0, std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.2)));
+    world.add(std::make_shared<Sphere>(Point3(2.5, 1, -1), 1.0, std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+
+    // a 64 x 64 grid of lamps floating at random heights, a few of them much brighter than the rest
+    for (int a = 0; a < 64; a++)
+    {
+        for (int b = 0; b < 64; b++)
+        {
+            Point3 center(-16 + a * 0.5 + randomDouble(0, 0.3), randomDouble(0.1, 2), -16 + b * 0.5 + randomDouble(0, 0.3));
+            auto strength = randomDouble() < 0.02 ? 40 : 4;
+            auto lamp = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(strength * Color::random(0.2, 1)));
+            if ((a + b) % 2)
+            {
+                world.add(std::make_shared<Sphere>(center, 0.04, lamp));
+            }
+            else
+            {
+                world.add(std::make_shared<Quad>(center, vec3(0.08, 0, 0), vec3(0, 0, 0.08), lamp));
+            }
+        }
+    }
+    world = HittableArray(std::make_shared<BVHNode>(world));
+
+    Camera camera(16.0 / 9.0, 400, 64, 20, 35, Point3(0, 5, 12), Point3(0, 0.5, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+// stand in for a photographed sky: a blue gradient above the horizon, dim ground below it and a small, very bright sun
+inline std::shared_ptr<EnvironmentLight> proceduralSky(int width, int height, const vec3 &sun_direction)
+{
+    std::vector<Color> pixels(static_cast<size_t>(width) * height);
+    auto sun = normalize(sun_direction);
+    for (int j = 0; j < height; j++)
+    {
+        auto theta = pi * (j + 0.5) / height;
+        for (int i = 0; i < width; i++)
+        {
+            auto phi = 2 * pi * (i + 0.5) / width;
+            vec3 direction(-sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            Color sky;
+            if (direction.y() > 0)
+            {
+                auto a = pow(direction.y(), 0.4);
+                sky = (1 - a) * Color(0.9, 0.9, 0.95) + a * Color(0.25, 0.45, 0.9);
+            }
+            else
+            {
+                sky = Color(0.15, 0.12, 0.1);
+            }
+            if (direction.dot(sun) > cos(0.03))
+            {
+                sky = Color(1000, 900, 750);
+            }
+            pixels[static_cast<size_t>(j) * width + i] = sky;
+        }
+    }
+    return std::make_shared<EnvironmentLight>(width, height, pixels);
+}
+inline Scene environmentScene()
+{
+    // outdoor lighting from an environment map, the sun covers a tiny part of the sky but gives most of the light
+    HittableArray world;
+
+    auto checker = std::make_shared<CheckerTexture>(0.5, Color(.2, .3, .1), Color(.9, .9, .9));
+    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
+    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, std::make_shared<Dielectric>(1.5)));
+    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1))));
+    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0)));
+
+    Camera camera(16.0 / 9.0, 400, 64, 20, 30, Point3(13, 2, 3), Point3(0, 1, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
+    // any lat-long .hdr saved as images/environment.hdr is used instead of the procedural sky
+    camera.environment = std::make_shared<EnvironmentLight>("environment.hdr");
+    if (!camera.environment->valid())
+    {
+        camera.environment = proceduralSky(1024, 512, vec3(-1, 1.2, 0.6));
+    }
+    return Scene{std::make_shared<HittableArray>(world), camera};
+}
+
+
+struct SceneEntry
+{
+    const char *name;
+    Scene (*build)();
+};
+// numbered from 1 in this order by main.cpp's scene choice
+inline const std::vector<SceneEntry> &builtinScenes()
+{
+    static const std::vector<SceneEntry> scenes = {
+        {"book1", finalBookOneScene},
+        {"two_spheres", twoSpheres},
+        {"earth", earth},
+        {"perlin", perlinSphere},
+        {"quads", quads},
+        {"simple_light", simpleLight},
+        {"cornell", cornellBox},
+        {"cornell_smoke", cornellSmoke},
+        {"book2", finalBookTwoScene},
+        {"moving_book1", movingBookOneScene},
+        {"cornell_cloud", cornellCloud},
+        {"many_lights", manyLights},
+        {"environment", environmentScene},
+    };
+    return scenes;
+}
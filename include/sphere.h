@@ -3,9 +3,11 @@
 #include <memory>
 #include <cmath>
 #include "aabb.h"
+#include "fast_math.h"
 #include "hittable.h"
 #include "interval.h"
 #include "material.h"
+#include "stats.h"
 #include "utilities.h"
 
 class Sphere : public Hittable
@@ -31,13 +33,52 @@ public:
     }
 
     AABB boundingBox() const override { return bbox; }
+    AABB boundingBoxAt(double time) const override
+    {
+        if (!is_moving)
+        {
+            return bbox;
+        }
+        auto radius_vector = vec3(radius, radius, radius);
+        auto center = getCenter(time);
+        return AABB(center - radius_vector, center + radius_vector);
+    }
     bool hit(const Ray &ray, Interval t_limit, hit_info &info) const override
     {
-        // placing P = A + tB in (P-C).(P-C) = radius^2 and solving for parameter t
-
         // check for movemement
-        double ray_time = ray.time();
-        Point3 center = is_moving ? getCenter(ray_time) : center_start;
+        Point3 center = is_moving ? getCenter(ray.time()) : center_start;
+        if (!hitSphere(center, radius, ray, t_limit, info))
+        {
+            return false;
+        }
+        info.mat = mat.get();
+        info.object = this;
+        return true;
+    }
+
+    bool convexSpan(const Ray &ray, Interval &span) const override
+    {
+        // both roots of the same quadratic as hitSphere, one solve instead of two hit queries
+        Point3 center = is_moving ? getCenter(ray.time()) : center_start;
+        vec3 oc = ray.origin() - center;
+        auto a = ray.direction().sqrLength();
+        auto b_half = oc.dot(ray.direction());
+        auto c = oc.sqrLength() - radius * radius;
+        auto discriminant = b_half * b_half - a * c;
+        if (discriminant < 0)
+        {
+            return false;
+        }
+        auto sqrtd = sqrt(discriminant);
+        span = Interval((-b_half - sqrtd) / a, (-b_half + sqrtd) / a);
+        return true;
+    }
+
+    // shared with the flat cached scene, fills everything in info except the material
+    static bool hitSphere(const Point3 &center, double radius, const Ray &ray, Interval t_limit, hit_info &info)
+    {
+        RT_STAT(STAT_SPHERE_TESTS);
+        // placing P = A + tB in (P-C).(P-C) = radius^2 and solving for parameter t
         vec3 oc = ray.origin() - center; // A-C
         // a,b,c in quadratic equation sense (optimized by putting b = 2b)
         auto a = ray.direction().sqrLength();          // B.B
@@ -66,7 +107,6 @@ public:
 
         info.t = root;
         info.p = ray.at(info.t);
-        info.mat = mat;
         // need unit vector, length of normal vector to sphere is radius
         vec3 outward_normal = (info.p - center) / radius;
         info.setNormalFace(ray, outward_normal);
@@ -74,6 +114,85 @@ public:
         return true;
     }
 
+    // for animation, moves the sphere (and its whole path if moving) so its start center is at _center_start.
+    // any bvh holding it has to be refit afterwards
+    void moveTo(const Point3 &_center_start)
+    {
+        center_start = _center_start;
+        auto radius_vector = vec3(radius, radius, radius);
+        AABB b1(center_start - radius_vector, center_start + radius_vector);
+        bbox = is_moving ? AABB(b1, b1 + center_delta) : b1;
+    }
+
+    Point3 centerStart() const { return center_start; }
+    vec3 centerDelta() const { return center_delta; }
+    double getRadius() const { return radius; }
+    bool isMoving() const { return is_moving; }
+    std::shared_ptr<Material> material() const { return mat; }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        visit(mat);
+    }
+
+    void visitLights(const std::function<void(const Hittable &, const Material &)> &visit) const override
+    {
+        if (mat->emits())
+        {
+            visit(*this, *mat);
+        }
+    }
+    double area() const override { return 4 * pi * radius * radius; }
+    // directions are picked uniformly inside the cone the sphere subtends, which only covers its visible side
+    double pdfValue(const Point3 &origin, const vec3 &direction, double time) const override
+    {
+        Point3 center = is_moving ? getCenter(time) : center_start;
+        auto dist_sqr = (center - origin).sqrLength();
+        hit_info info;
+        if (dist_sqr <= radius * radius || !hitSphere(center, radius, Ray(origin, direction, time), Interval(0.001, infinity), info))
+        {
+            return 0;
+        }
+        auto cos_theta_max = sqrt(1 - radius * radius / dist_sqr);
+        return 1 / (2 * pi * (1 - cos_theta_max));
+    }
+    vec3 randomDirection(const Point3 &origin, double time, double u1, double u2) const override
+    {
+        Point3 center = is_moving ? getCenter(time) : center_start;
+        vec3 axis = center - origin;
+        auto dist_sqr = axis.sqrLength();
+        if (dist_sqr <= radius * radius)
+        {
+            // from inside every direction hits, pdfValue says 0 so nothing is counted
+            return axis;
+        }
+        auto cos_theta_max = sqrt(1 - radius * radius / dist_sqr);
+        auto z = 1 + u2 * (cos_theta_max - 1);
+        auto r = sqrt(fmax(0.0, 1 - z * z));
+        auto phi = 2 * pi * u1;
+
+        // orthonormal basis around the axis
+        vec3 w = normalize(axis);
+        vec3 a = fabs(w.x()) > 0.9 ? vec3(0, 1, 0) : vec3(1, 0, 0);
+        vec3 v = normalize(w.cross(a));
+        vec3 u = w.cross(v);
+        return r * cos(phi) * u + r * sin(phi) * v + z * w;
+    }
+    bool samplePoint(double time, double u1, double u2, hit_info &info) const override
+    {
+        // uniform on the unit sphere, z uniform in [-1, 1]
+        auto z = 1 - 2 * u1;
+        auto r = sqrt(fmax(0.0, 1 - z * z));
+        auto phi = 2 * pi * u2;
+        vec3 outward_normal(r * cos(phi), r * sin(phi), z);
+        info.p = (is_moving ? getCenter(time) : center_start) + radius * outward_normal;
+        info.normal = outward_normal;
+        info.front_face = true;
+        getSphereUV(outward_normal, info.u, info.v);
+        info.mat = mat.get();
+        info.object = this;
+        return true;
+    }
+
 private:
     Point3 center_start;
     vec3 center_delta;
@@ -94,8 +213,8 @@ private:
 
     //derivation from spherical coordinates, mapping x y z to u v,
     // we use u = phi /2pi, v = theta/pi
-    auto theta = acos(-p.y());
-    auto phi = atan2(-p.z(), p.x()) + pi;
+    auto theta = rtAcos(-p.y());
+    auto phi = rtAtan2(-p.z(), p.x()) + pi;
     u = phi / (2*pi);
     v = theta / pi;
     }
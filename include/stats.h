@@ -0,0 +1,167 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Render statistics: counts of rays, traversal steps, primitive tests and how paths ended.
+// Only compiled in with RT_STATS defined (cmake -DRAYCASTER_STATS=ON), otherwise RT_STAT is nothing at all and the
+// hot paths are exactly as without it. Every thread counts into its own block, no atomics or shared cache lines, and
+// the blocks are summed when a render reports. The counts are process wide: parallel photon shooting is included,
+// forked tile workers are not. Render server jobs run side by side, so they neither reset nor report them.
+
+enum StatCounter
+{
+    STAT_PRIMARY_RAYS,
+    STAT_SECONDARY_RAYS,
+    STAT_SHADOW_RAYS,
+    STAT_PHOTON_RAYS,
+    STAT_BVH_NODES,
+    STAT_AABB_TESTS,
+    STAT_SPHERE_TESTS,
+    STAT_QUAD_TESTS,
+    STAT_MEDIUM_TESTS,
+    STAT_PATHS_ESCAPED,
+    STAT_PATHS_ABSORBED,
+    STAT_PATHS_DEPTH_LIMIT,
+    STAT_PATH_BOUNCES, // summed over ended paths, for the average depth
+    STAT_COUNT
+};
+
+inline const char *statName(int counter)
+{
+    static const char *names[STAT_COUNT] = {"primary_rays", "secondary_rays", "shadow_rays", "photon_rays",
+                                            "bvh_nodes_visited", "aabb_tests", "sphere_tests", "quad_tests",
+                                            "medium_tests", "paths_escaped", "paths_absorbed", "paths_depth_limit",
+                                            "path_bounces"};
+    return names[counter];
+}
+
+struct RenderStats
+{
+    uint64_t counts[STAT_COUNT] = {};
+
+    void add(const RenderStats &other)
+    {
+        for (int c = 0; c < STAT_COUNT; c++)
+        {
+            counts[c] += other.counts[c];
+        }
+    }
+    uint64_t operator[](StatCounter c) const { return counts[c]; }
+
+    uint64_t rays() const { return counts[STAT_PRIMARY_RAYS] + counts[STAT_SECONDARY_RAYS] + counts[STAT_SHADOW_RAYS] + counts[STAT_PHOTON_RAYS]; }
+    uint64_t paths() const { return counts[STAT_PATHS_ESCAPED] + counts[STAT_PATHS_ABSORBED] + counts[STAT_PATHS_DEPTH_LIMIT]; }
+    uint64_t primitiveTests() const { return counts[STAT_SPHERE_TESTS] + counts[STAT_QUAD_TESTS] + counts[STAT_MEDIUM_TESTS]; }
+    static double ratio(uint64_t a, uint64_t b) { return b > 0 ? static_cast<double>(a) / b : 0; }
+
+    void print(std::ostream &out, double seconds) const
+    {
+        auto rays = this->rays();
+        auto paths = this->paths();
+        out << "Render statistics (" << seconds << " s)\n";
+        out << "  rays " << rays << ", " << rays / std::max(seconds, 1e-9) / 1e6 << " M/s: "
+            << counts[STAT_PRIMARY_RAYS] << " primary, " << counts[STAT_SECONDARY_RAYS] << " secondary, "
+            << counts[STAT_SHADOW_RAYS] << " shadow, " << counts[STAT_PHOTON_RAYS] << " photon\n";
+        out << "  per ray: " << ratio(counts[STAT_BVH_NODES], rays) << " bvh nodes, "
+            << ratio(counts[STAT_AABB_TESTS], rays) << " box tests, " << ratio(primitiveTests(), rays)
+            << " primitive tests (" << counts[STAT_SPHERE_TESTS] << " sphere, " << counts[STAT_QUAD_TESTS]
+            << " quad, " << counts[STAT_MEDIUM_TESTS] << " medium in all)\n";
+        out << "  paths " << paths << ", " << ratio(counts[STAT_PATH_BOUNCES], paths) << " bounces on average: "
+            << 100 * ratio(counts[STAT_PATHS_ESCAPED], paths) << "% escaped, "
+            << 100 * ratio(counts[STAT_PATHS_ABSORBED], paths) << "% absorbed, "
+            << 100 * ratio(counts[STAT_PATHS_DEPTH_LIMIT], paths) << "% hit the depth limit\n";
+    }
+
+    bool writeJson(const std::string &path, double seconds) const
+    {
+        std::ofstream out(path);
+        auto rays = this->rays();
+        auto paths = this->paths();
+        out << std::setprecision(10) << "{\n  \"seconds\": " << seconds << ",\n  \"counters\": {\n";
+        for (int c = 0; c < STAT_COUNT; c++)
+        {
+            out << "    \"" << statName(c) << "\": " << counts[c] << (c + 1 < STAT_COUNT ? ",\n" : "\n");
+        }
+        out << "  },\n  \"rays\": " << rays << ",\n  \"rays_per_second\": " << rays / std::max(seconds, 1e-9)
+            << ",\n  \"paths\": " << paths << ",\n  \"average_path_depth\": " << ratio(counts[STAT_PATH_BOUNCES], paths)
+            << ",\n  \"bvh_nodes_per_ray\": " << ratio(counts[STAT_BVH_NODES], rays)
+            << ",\n  \"aabb_tests_per_ray\": " << ratio(counts[STAT_AABB_TESTS], rays)
+            << ",\n  \"primitive_tests_per_ray\": " << ratio(primitiveTests(), rays) << "\n}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+// every thread's block, and what threads that have since exited counted
+class StatsRegistry
+{
+public:
+    static StatsRegistry &instance()
+    {
+        static StatsRegistry registry;
+        return registry;
+    }
+
+    // sums and zeroes are only exact while no other thread is counting, true at the start and end of a render
+    RenderStats total()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        RenderStats sum = retired;
+        for (auto *block : live)
+        {
+            sum.add(*block);
+        }
+        return sum;
+    }
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired = RenderStats();
+        for (auto *block : live)
+        {
+            *block = RenderStats();
+        }
+    }
+
+    void enter(RenderStats *block)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        live.push_back(block);
+    }
+    void leave(RenderStats *block)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        retired.add(*block);
+        live.erase(std::remove(live.begin(), live.end(), block), live.end());
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<RenderStats *> live;
+    RenderStats retired;
+};
+
+struct ThreadStats
+{
+    RenderStats stats;
+    ThreadStats() { StatsRegistry::instance().enter(&stats); }
+    ~ThreadStats() { StatsRegistry::instance().leave(&stats); }
+};
+inline RenderStats &threadStats()
+{
+    static thread_local ThreadStats block;
+    return block.stats;
+}
+
+#ifdef RT_STATS
+#define RT_STAT_ADD(counter, n) (threadStats().counts[counter] += (n))
+constexpr bool stats_compiled = true;
+#else
+#define RT_STAT_ADD(counter, n) ((void)0)
+constexpr bool stats_compiled = false;
+#endif
+#define RT_STAT(counter) RT_STAT_ADD(counter, 1)
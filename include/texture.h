@@ -23,6 +23,7 @@ public:
         // just returns a constant colour
         return color;
     }
+    Color colorValue() const { return color; }
 
 private:
     Color color;
@@ -45,6 +46,10 @@ public:
 
         return isEven ? even->value(u, v, point) : odd->value(u, v, point);
     }
+    double scale() const { return 1.0 / inverse_scale; }
+    double inverseScale() const { return inverse_scale; }
+    std::shared_ptr<Texture> evenTexture() const { return even; }
+    std::shared_ptr<Texture> oddTexture() const { return odd; }
 
 private:
     double inverse_scale;
@@ -55,7 +60,7 @@ private:
 class ImageTexture : public Texture
 {
 public:
-    ImageTexture(const char *filename) : image(filename) {}
+    ImageTexture(const char *filename) : image(filename), name(filename) {}
     Color value(double u, double v, const Point3 &point) const override
     {
         // if no image loaded, default is cyan
@@ -73,9 +78,12 @@ public:
         // to scale down rgb values bw 0 and 1.
         return Color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
     }
+    // name as given, resolved against the images directory by Image
+    const std::string &fileName() const { return name; }
 
 private:
     Image image;
+    std::string name;
 };
 
 class NoiseTexture : public Texture
@@ -90,6 +98,7 @@ public:
         auto scaled = frequency*point;
         return Color(1.0, 1.0, 1.0)*0.5*(1.0 + sin(scaled.z() + 10*noise.turbulence(scaled)));
     }
+    double noiseFrequency() const { return frequency; }
 
 private:
     Perlin noise;
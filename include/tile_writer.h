@@ -0,0 +1,106 @@
+#pragma once
+#include <cerrno>
+#include <string>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "distributed.h"
+
+// Writes an image into a binary ppm (P6) file tile by tile, in whatever order the tiles finish. A P6 pixel is always
+// three bytes after a fixed header, so where every row of every tile goes is known up front: each is written straight
+// to its place and nothing of the image stays in memory. The file is sized when opened, rows not written yet read as
+// black. Tiles as wide as the image are strips, whose rows follow each other in the file and go out in one write.
+
+class TileWriter
+{
+public:
+    TileWriter() {}
+    TileWriter(const TileWriter &) = delete;
+    TileWriter &operator=(const TileWriter &) = delete;
+    ~TileWriter() { close(); }
+
+    // the file holds the pixels of area, its top left corner first
+    bool open(const std::string &path, const Tile &_area)
+    {
+        close();
+        area = _area;
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return false;
+        }
+        auto header = "P6\n" + std::to_string(area.x1 - area.x0) + " " + std::to_string(area.y1 - area.y0) + "\n255\n";
+        header_size = static_cast<off_t>(header.size());
+        if (!writeAt(header.data(), header.size(), 0) || ftruncate(fd, header_size + 3 * static_cast<off_t>(area.pixelCount())) != 0)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+    bool isOpen() const { return fd >= 0; }
+
+    // rgb holds the tile's pixels as bytes, three per pixel, row by row. the tile has to lie within the area
+    bool write(const Tile &tile, const unsigned char *rgb)
+    {
+        if (fd < 0 || tile.x0 < area.x0 || tile.y0 < area.y0 || tile.x1 > area.x1 || tile.y1 > area.y1)
+        {
+            return false;
+        }
+        auto row_bytes = 3 * static_cast<size_t>(tile.x1 - tile.x0);
+        if (tile.x0 == area.x0 && tile.x1 == area.x1)
+        {
+            return writeAt(rgb, row_bytes * (tile.y1 - tile.y0), offset(tile.x0, tile.y0));
+        }
+        for (int j = tile.y0; j < tile.y1; j++)
+        {
+            if (!writeAt(rgb + row_bytes * (j - tile.y0), row_bytes, offset(tile.x0, j)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // false if the file could not be finished
+    bool close()
+    {
+        if (fd < 0)
+        {
+            return true;
+        }
+        bool closed = ::close(fd) == 0;
+        fd = -1;
+        return closed;
+    }
+
+private:
+    int fd = -1;
+    Tile area = Tile{0, 0, 0, 0};
+    off_t header_size = 0;
+
+    off_t offset(int i, int j) const
+    {
+        return header_size + 3 * (static_cast<off_t>(j - area.y0) * (area.x1 - area.x0) + (i - area.x0));
+    }
+    bool writeAt(const void *data, size_t size, off_t at)
+    {
+        auto bytes = static_cast<const char *>(data);
+        while (size > 0)
+        {
+            auto written = pwrite(fd, bytes, size, at);
+            if (written < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (written <= 0)
+            {
+                return false;
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+            at += written;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+// Timeline of a render's phases (scene build, bvh build, texture decoding, tracing, output) and of its tiles, written
+// as Chrome trace event json for chrome://tracing or ui.perfetto.dev, where load imbalance and stalls show up as gaps.
+// Off until enable(), a TraceScope then costs a flag check. Each thread appends to a buffer of its own without any
+// locking, only a thread's first event takes the registry's lock to hand out the buffer. write() reads all buffers,
+// so call it once the threads it should cover are done.
+
+struct TraceEvent
+{
+    std::string name;
+    const char *category;
+    double start, duration; // microseconds since enable()
+    int pid, tid;           // 0 for this process and the recording thread
+};
+
+class Tracer
+{
+public:
+    static Tracer &instance()
+    {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    void enable()
+    {
+        epoch = std::chrono::steady_clock::now();
+        enabled.store(true, std::memory_order_relaxed);
+    }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+    double now() const { return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count(); }
+
+    // a finished span on the calling thread, or with pid (and tid) set on a row of its own, like a worker process's
+    void record(std::string name, const char *category, double start, double end, int pid = 0, int tid = 0)
+    {
+        if (!isEnabled())
+        {
+            return;
+        }
+        threadBuffer().events.push_back(TraceEvent{std::move(name), category, start, end - start, pid, tid});
+    }
+    // label for the calling thread's row
+    void nameThread(const std::string &name)
+    {
+        if (isEnabled())
+        {
+            threadBuffer().name = name;
+        }
+    }
+    // label for a row of another process, the worker rows of a tile farm
+    void nameProcess(int pid, const std::string &name)
+    {
+        if (isEnabled())
+        {
+            threadBuffer().process_names.push_back({pid, name});
+        }
+    }
+
+    bool write(const std::string &path)
+    {
+        std::ofstream out(path);
+        int self = static_cast<int>(getpid());
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        auto separator = [&]()
+        {
+            out << (first ? "" : ",\n");
+            first = false;
+        };
+        for (const auto &buffer : buffers)
+        {
+            separator();
+            out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << self << ", \"tid\": " << buffer->tid
+                << ", \"args\": {\"name\": \"" << escape(buffer->name) << "\"}}";
+            for (const auto &process : buffer->process_names)
+            {
+                separator();
+                out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << process.first
+                    << ", \"args\": {\"name\": \"" << escape(process.second) << "\"}}";
+            }
+            for (const auto &event : buffer->events)
+            {
+                separator();
+                out << "{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << event.category
+                    << "\", \"ph\": \"X\", \"ts\": " << event.start << ", \"dur\": " << event.duration
+                    << ", \"pid\": " << (event.pid != 0 ? event.pid : self)
+                    << ", \"tid\": " << (event.pid != 0 ? event.tid : buffer->tid) << "}";
+            }
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    struct ThreadBuffer
+    {
+        int tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+        std::vector<std::pair<int, std::string>> process_names;
+    };
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    // kept after their threads exit, the short lived threads of parallelFor included
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+    ThreadBuffer &threadBuffer()
+    {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffer = std::make_shared<ThreadBuffer>();
+            buffer->tid = static_cast<int>(buffers.size()) + 1;
+            buffer->name = buffer->tid == 1 ? "main" : "thread " + std::to_string(buffer->tid);
+            buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped += '\\';
+            }
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// records the span from construction to destruction on the calling thread. a null name records nothing
+class TraceScope
+{
+public:
+    TraceScope(const char *_name, const char *_category = "phase") : name(_name), category(_category)
+    {
+        active = name != nullptr && Tracer::instance().isEnabled();
+        if (active)
+        {
+            start = Tracer::instance().now();
+        }
+    }
+    ~TraceScope()
+    {
+        if (active)
+        {
+            Tracer::instance().record(name, category, start, Tracer::instance().now());
+        }
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    const char *category;
+    bool active;
+    double start = 0;
+};
@@ -4,7 +4,7 @@
 #include <cstdlib>
 
 const double infinity = std::numeric_limits<double>::infinity();
-const double pi = 3.14159;
+const double pi = 3.1415926535897932385;
 
 inline double degreeToRadians(double degrees)
 {
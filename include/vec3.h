@@ -6,9 +6,63 @@
 
 using std::sqrt;
 
+// Two backends behind the same interface. The default is three plain doubles. With RT_SIMD_VEC3 defined
+// (cmake -DRAYCASTER_SIMD_VEC3=ON) the components sit in a 32 byte aligned vector of four lanes (gcc and clang vector
+// extensions, the fourth lane always zero), so arithmetic is one AVX instruction rather than three scalar ones.
+// Without AVX the compiler splits the vector over two SSE2 registers and building one from scalars goes through
+// memory, which is slower than plain doubles, so the cmake option turns on AVX. Everything outside this file only
+// uses the interface.
+
 class vec3
 {
 public:
+#ifdef RT_SIMD_VEC3
+    typedef double Lanes __attribute__((vector_size(32)));
+    Lanes lanes;
+
+    vec3() : lanes{0, 0, 0, 0} {}
+    vec3(double c1, double c2, double c3) : lanes{c1, c2, c3, 0} {}
+    explicit vec3(const Lanes &_lanes) : lanes(_lanes) {}
+
+    double x() const { return lanes[0]; }
+    double y() const { return lanes[1]; }
+    double z() const { return lanes[2]; }
+
+    vec3 operator-() const { return vec3(-lanes); }
+    double operator[](int i) const { return lanes[i]; }
+    // vector types may alias their element type
+    double &operator[](int i) { return reinterpret_cast<double *>(&lanes)[i]; }
+
+    vec3 &operator+=(const vec3 &v)
+    {
+        lanes += v.lanes;
+        return *this;
+    }
+    vec3 &operator*=(double val)
+    {
+        lanes *= val;
+        return *this;
+    }
+    vec3 &operator/=(double val)
+    {
+        return *this *= 1 / val;
+    }
+    double sqrLength() const { return dot(*this); }
+    double length() const { return sqrt(sqrLength()); }
+    double dot(const vec3 &v) const
+    {
+        Lanes p = lanes * v.lanes;
+        return p[0] + p[1] + p[2];
+    }
+    vec3 cross(const vec3 &v) const
+    {
+        Lanes a_yzx = __builtin_shufflevector(lanes, lanes, 1, 2, 0, 3);
+        Lanes b_yzx = __builtin_shufflevector(v.lanes, v.lanes, 1, 2, 0, 3);
+        // a x b = a.yzx * b.zxy - a.zxy * b.yzx, with the shuffle taken out of the difference
+        Lanes c = lanes * b_yzx - a_yzx * v.lanes;
+        return vec3(__builtin_shufflevector(c, c, 1, 2, 0, 3));
+    }
+#else
     double comp[3];
 
     vec3() : comp{0, 0, 0} {}
@@ -46,26 +100,27 @@ public:
     {
         return *this *= 1 / val;
     }
-    double sqrLength()
+    double sqrLength() const
     {
         return (comp[0] * comp[0]) + (comp[1] * comp[1]) + (comp[2] * comp[2]);
     }
 
-    double length()
+    double length() const
     {
         return sqrt(sqrLength());
     }
 
-    double dot(const vec3 &v)
+    double dot(const vec3 &v) const
     {
         return (comp[0] * v[0]) + (comp[1] * v[1]) + (comp[2] * v[2]);
     }
-    vec3 cross(const vec3 &v)
+    vec3 cross(const vec3 &v) const
     {
         return vec3(comp[1] * v.comp[2] - comp[2] * v.comp[1],
                     comp[2] * v.comp[0] - comp[0] * v.comp[2],
                     comp[0] * v.comp[1] - comp[1] * v.comp[0]);
     }
+#endif
     static vec3 random()
     {
         return vec3(randomDouble(), randomDouble(), randomDouble());
@@ -78,7 +133,7 @@ public:
     {
         // Return true if the vector is close to zero in all dimensions.
         auto s = 1e-8;
-        return (fabs(comp[0]) < s) && (fabs(comp[1]) < s) && (fabs(comp[2]) < s);
+        return (fabs(x()) < s) && (fabs(y()) < s) && (fabs(z()) < s);
     }
 };
 
@@ -86,9 +141,15 @@ using Point3 = vec3; // alias for readability
 
 inline std::ostream &operator<<(std::ostream &out, const vec3 &v)
 {
-    return out << v.comp[0] << ' ' << v.comp[1] << ' ' << v.comp[2];
+    return out << v.x() << ' ' << v.y() << ' ' << v.z();
 }
 
+#ifdef RT_SIMD_VEC3
+inline vec3 operator+(const vec3 &u, const vec3 &v) { return vec3(u.lanes + v.lanes); }
+inline vec3 operator-(const vec3 &u, const vec3 &v) { return vec3(u.lanes - v.lanes); }
+inline vec3 operator*(const vec3 &u, const vec3 &v) { return vec3(u.lanes * v.lanes); }
+inline vec3 operator*(double t, const vec3 &v) { return vec3(t * v.lanes); }
+#else
 inline vec3 operator+(const vec3 &u, const vec3 &v)
 {
     return vec3(u.comp[0] + v.comp[0], u.comp[1] + v.comp[1], u.comp[2] + v.comp[2]);
@@ -109,37 +170,64 @@ inline vec3 operator*(double t, const vec3 &v)
 {
     return vec3(t * v.comp[0], t * v.comp[1], t * v.comp[2]);
 }
+#endif
 
 inline vec3 operator*(const vec3 &v, double t)
 {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t)
+inline vec3 operator/(const vec3 &v, double t)
 {
     return (1 / t) * v;
 }
 
 // need to define here as it depends on above overload
-inline vec3 normalize(vec3 v)
+inline vec3 normalize(const vec3 &v)
 {
     return v / v.length();
 }
 
-inline vec3 randomInUnitSphere()
+// direct warps from uniform numbers in [0, 1) to the shapes below, no rejection loops.
+// they keep the stratification of whatever produced u1 u2, which a rejection loop throws away
+inline vec3 sampleUnitDisk(double u1, double u2)
 {
-    while (true)
+    // concentric mapping (Shirley Chiu), squares to rings with little distortion
+    auto a = 2 * u1 - 1;
+    auto b = 2 * u2 - 1;
+    if (a == 0 && b == 0)
     {
-        auto p = vec3::random(-1, 1);
-        if (p.sqrLength() < 1)
-        {
-            return p;
-        }
+        return vec3(0, 0, 0);
     }
+    double r, theta;
+    if (fabs(a) > fabs(b))
+    {
+        r = a;
+        theta = (pi / 4) * (b / a);
+    }
+    else
+    {
+        r = b;
+        theta = (pi / 2) - (pi / 4) * (a / b);
+    }
+    return vec3(r * cos(theta), r * sin(theta), 0);
+}
+inline vec3 sampleUnitSphere(double u1, double u2)
+{
+    // uniform on the surface, z uniform in [-1, 1] (Archimedes) and a uniform angle around it
+    auto z = 1 - 2 * u1;
+    auto r = sqrt(fmax(0.0, 1 - z * z));
+    auto phi = 2 * pi * u2;
+    return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+inline vec3 randomInUnitSphere()
+{
+    return sampleUnitSphere(randomDouble(), randomDouble()) * cbrt(randomDouble());
 }
 inline vec3 randomUnitVec()
 {
-    return normalize(randomInUnitSphere());
+    return sampleUnitSphere(randomDouble(), randomDouble());
 }
 inline vec3 randomOnHemisphere(const vec3 &normal)
 {
@@ -154,19 +242,15 @@ inline vec3 randomOnHemisphere(const vec3 &normal)
     }
 }
 inline vec3 randomInUnitDisk() {
-    while (true) {
-        auto p = vec3(randomDouble(-1,1), randomDouble(-1,1), 0);
-        if (p.sqrLength() < 1)
-            return p;
-    }
+    return sampleUnitDisk(randomDouble(), randomDouble());
 }
 
-inline vec3 reflect(vec3 &v, const vec3 &normal)
+inline vec3 reflect(const vec3 &v, const vec3 &normal)
 {
     return v - 2 * v.dot(normal) * normal;
 }
 
-inline vec3 refract(vec3& v, const vec3& normal, double eta_ibyr)
+inline vec3 refract(const vec3& v, const vec3& normal, double eta_ibyr)
 {   
     auto cos_theta = fmin(-v.dot(normal), 1.0);
     auto r_out_perpendicular = eta_ibyr*(v + cos_theta*normal);
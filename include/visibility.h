@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "bvh_node.h"
+#include "hittable.h"
+#include "hittable_array.h"
+#include "interval.h"
+#include "vec3.h"
+
+// Binned primary visibility: with a pinhole camera every camera ray starts at the same point, so what a screen tile
+// can see is known before tracing. Every primitive's box is projected onto the screen and the primitive is added to
+// the bin of every tile it may cover, then camera rays test just their tile's bin, nearest first, instead of
+// walking the bvh from the root. A bin is a conservative superset, widened by the half pixel a sample may be jittered
+// by, and the hits are exact ray tests, so the first hits are the same as the bvh's. Boxes of moving objects cover
+// their whole sweep, so motion blur needs nothing special. Defocus moves the ray origin off the projection centre,
+// the camera then traces against the world as before.
+// The bins themselves are Hittables, a camera ray's first hit only needs hit().
+
+class VisibilityBins
+{
+public:
+    // the screen is width x height pixels, pixel (i, j) centred on top_left + i * du + j * dv, seen from center
+    // looking along forward (unit length). tile is the bin size in pixels
+    void build(const Hittable &world, const Point3 &center, const vec3 &forward, const Point3 &top_left,
+               const vec3 &du, const vec3 &dv, int width, int height, int tile)
+    {
+        tile_size = tile;
+        tiles_x = (width + tile - 1) / tile;
+        tiles_y = (height + tile - 1) / tile;
+        bins.assign(static_cast<size_t>(tiles_x) * tiles_y, Bin());
+
+        std::vector<const Hittable *> leaves;
+        collectLeaves(world, leaves);
+        vec3 axis = forward;
+        // distance of the pixel plane, where screen positions are measured
+        auto plane = (top_left - center).dot(axis);
+        vec3 du_unit = du, dv_unit = dv;
+        du_unit /= du_unit.sqrLength();
+        dv_unit /= dv_unit.sqrLength();
+        // camera rays start hitting at t = 0.001, a depth of 0.001 * plane, nothing nearer needs covering
+        auto clip = 0.0005 * plane;
+        for (const auto &leaf : leaves)
+        {
+            auto box = leaf->boundingBox();
+            Point3 corners[8];
+            double depths[8];
+            double near = infinity;
+            for (int c = 0; c < 8; c++)
+            {
+                corners[c] = Point3((c & 1 ? box.x.max : box.x.min), (c & 2 ? box.y.max : box.y.min), (c & 4 ? box.z.max : box.z.min));
+                vec3 d = corners[c] - center;
+                depths[c] = d.dot(axis);
+                near = std::min(near, depths[c]);
+            }
+            // the box clipped to the near plane: its corners in front of it and where its edges cross it
+            double x0 = infinity, x1 = -infinity, y0 = infinity, y1 = -infinity;
+            auto project = [&](const Point3 &p, double depth)
+            {
+                vec3 on_plane = center + (p - center) * (plane / depth) - top_left;
+                auto x = on_plane.dot(du_unit), y = on_plane.dot(dv_unit);
+                x0 = std::min(x0, x);
+                x1 = std::max(x1, x);
+                y0 = std::min(y0, y);
+                y1 = std::max(y1, y);
+            };
+            for (int c = 0; c < 8; c++)
+            {
+                if (depths[c] >= clip)
+                {
+                    project(corners[c], depths[c]);
+                }
+                for (int axis_bit = 1; axis_bit < 8; axis_bit <<= 1)
+                {
+                    int other = c | axis_bit;
+                    if (other != c && (depths[c] < clip) != (depths[other] < clip))
+                    {
+                        auto f = (clip - depths[c]) / (depths[other] - depths[c]);
+                        project(corners[c] + f * (corners[other] - corners[c]), clip);
+                    }
+                }
+            }
+            if (x0 > x1)
+            {
+                // all of it behind the camera
+                continue;
+            }
+            // a pixel's samples land within half a pixel of its centre, one more for rounding
+            auto toPixel = [](double x, int low, int high)
+            { return static_cast<int>(std::max(double(low), std::min(double(high), x))); };
+            int i0 = toPixel(std::floor(x0 - 1.5), 0, width - 1), i1 = toPixel(std::ceil(x1 + 1.5), -1, width - 1);
+            int j0 = toPixel(std::floor(y0 - 1.5), 0, height - 1), j1 = toPixel(std::ceil(y1 + 1.5), -1, height - 1);
+            for (int ty = j0 / tile; i0 <= i1 && j0 <= j1 && ty <= j1 / tile; ty++)
+            {
+                for (int tx = i0 / tile; tx <= i1 / tile; tx++)
+                {
+                    bins[ty * tiles_x + tx].entries.push_back(Entry{leaf, near});
+                }
+            }
+        }
+        for (auto &bin : bins)
+        {
+            std::sort(bin.entries.begin(), bin.entries.end(), [](const Entry &a, const Entry &b)
+                      { return a.near < b.near; });
+            bin.axis = axis;
+        }
+    }
+    void clear() { bins.clear(); }
+    bool empty() const { return bins.empty(); }
+
+    // the bin of pixel (i, j), null without bins or when the bin is too crowded to beat the bvh
+    const Hittable *binAt(int i, int j) const
+    {
+        if (bins.empty())
+        {
+            return nullptr;
+        }
+        const auto &bin = bins[(j / tile_size) * tiles_x + i / tile_size];
+        return bin.entries.size() <= max_entries ? &bin : nullptr;
+    }
+
+    // primitives per bin on average, how much a camera ray tests at most
+    double averageBinSize() const
+    {
+        size_t total = 0;
+        for (const auto &bin : bins)
+        {
+            total += bin.entries.size();
+        }
+        return bins.empty() ? 0 : static_cast<double>(total) / bins.size();
+    }
+
+private:
+    struct Entry
+    {
+        const Hittable *object;
+        double near; // nearest depth along the view axis of its box
+    };
+    // a tile's primitives, nearest box first
+    class Bin : public Hittable
+    {
+    public:
+        std::vector<Entry> entries;
+        vec3 axis;
+
+        bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
+        {
+            // depth along the view axis per unit of t, the same for every camera ray of a pinhole camera
+            auto depth_per_t = ray.direction().dot(axis);
+            bool hit_anything = false;
+            for (const auto &entry : entries)
+            {
+                // everything left starts beyond the closest hit so far
+                if (hit_anything && entry.near > t_limits.max * depth_per_t)
+                {
+                    break;
+                }
+                if (entry.object->hit(ray, t_limits, info))
+                {
+                    hit_anything = true;
+                    t_limits.max = info.t;
+                }
+            }
+            return hit_anything;
+        }
+        AABB boundingBox() const override { return AABB(); }
+    };
+
+    // past this many primitives a ray that hits nothing (or only far away) tests more than a bvh walk costs
+    static const size_t max_entries = 24;
+    int tile_size = 16, tiles_x = 0, tiles_y = 0;
+    std::vector<Bin> bins; // they point into the world, which outlives the render they are built for
+
+    // the primitives under the world's bvh nodes and arrays, anything else (transforms, media, mapped scenes) is a
+    // primitive of its own
+    static void collectLeaves(const Hittable &object, std::vector<const Hittable *> &leaves)
+    {
+        if (auto node = dynamic_cast<const BVHNode *>(&object))
+        {
+            collectLeaves(*node->leftChild(), leaves);
+            if (node->rightChild() != node->leftChild())
+            {
+                collectLeaves(*node->rightChild(), leaves);
+            }
+        }
+        else if (auto array = dynamic_cast<const HittableArray *>(&object))
+        {
+            for (const auto &child : array->objects)
+            {
+                collectLeaves(*child, leaves);
+            }
+        }
+        else
+        {
+            leaves.push_back(&object);
+        }
+    }
+};
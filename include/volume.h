@@ -1,8 +1,14 @@
 #pragma once
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
 #include "hittable.h"
 #include "material.h"
 #include "aabb.h"
+#include "fast_math.h"
 #include "texture.h"
+#include "stats.h"
 
 class ConstantMedium : public Hittable
 {
@@ -12,53 +18,363 @@ public:
 
     bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
     {
+        RT_STAT(STAT_MEDIUM_TESTS);
         // a lot of gymnastics here just to account for hit from within volume
-        hit_info hit1, hit2;
-
-        // general hit checks
-        if (!boundary->hit(ray, universe, hit1))
-        {
-            return false;
-        }
-        if (!boundary->hit(ray, Interval(hit1.t + 0.0001, infinity), hit2))
+        // entry and exit in one query, a single solve for spheres
+        Interval span;
+        if (!boundary->convexSpan(ray, span))
         {
             return false;
         }
 
         // these checks make more sense when u think from POV of ray from inside object
-        if (hit1.t < t_limits.min)
-            hit1.t = t_limits.min;
-        if (hit2.t > t_limits.max)
-            hit2.t = t_limits.max;
+        if (span.min < t_limits.min)
+            span.min = t_limits.min;
+        if (span.max > t_limits.max)
+            span.max = t_limits.max;
 
-        if (hit1.t >= hit2.t)
+        if (span.min >= span.max)
         {
             return false;
         }
 
-        if (hit1.t < 0)
+        if (span.min < 0)
         {
-            hit1.t = 0;
+            span.min = 0;
         }
         auto ray_length = ray.direction().length();
-        auto distance_inside_boundary = (hit2.t - hit1.t) * ray_length;
-        auto hit_distance = neg_inv_density * log(randomDouble());
+        auto distance_inside_boundary = (span.max - span.min) * ray_length;
+        auto hit_distance = neg_inv_density * rtLog(randomDouble());
 
         if(hit_distance > distance_inside_boundary)
         {
             return false;
         }
-        info.t = hit1.t + hit_distance / ray_length;
-        info.p = ray.at(hit1.t);
+        info.t = span.min + hit_distance / ray_length;
+        info.p = ray.at(info.t);
         info.normal = vec3(1, 1 ,1); //arbitrary
         info.front_face = true; //arbitrary
-        info.mat = phase_function;
+        info.mat = phase_function.get();
+        info.object = this;
         return true;
     }
     AABB boundingBox() const override {return boundary->boundingBox();}
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        visit(phase_function);
+    }
 
 private:
     std::shared_ptr<Hittable> boundary;
     double neg_inv_density;
     std::shared_ptr<Material> phase_function;
-};
\ No newline at end of file
+};
+
+// Density sampled on a regular voxel grid spanning bounds, trilinearly interpolated between voxel centers.
+// values are extinction per unit length, zero outside bounds.
+class VoxelGrid
+{
+public:
+    VoxelGrid(const AABB &_bounds, int _nx, int _ny, int _nz) : bounds(_bounds), nx(_nx), ny(_ny), nz(_nz)
+    {
+        cell = vec3(bounds.x.size() / nx, bounds.y.size() / ny, bounds.z.size() / nz);
+    }
+    virtual ~VoxelGrid() = default;
+
+    virtual double voxel(int i, int j, int k) const = 0;
+    virtual void setVoxel(int i, int j, int k, double value) = 0;
+
+    // sets every voxel to f(voxel center)
+    template <typename F>
+    void fill(F f)
+    {
+        for (int k = 0; k < nz; k++)
+            for (int j = 0; j < ny; j++)
+                for (int i = 0; i < nx; i++)
+                {
+                    auto p = Point3(bounds.x.min + (i + 0.5) * cell.x(), bounds.y.min + (j + 0.5) * cell.y(), bounds.z.min + (k + 0.5) * cell.z());
+                    setVoxel(i, j, k, f(p));
+                }
+    }
+
+    double density(const Point3 &p) const
+    {
+        // continuous voxel coordinates, voxel centers sit at integer + 0.5
+        auto gx = (p.x() - bounds.x.min) / cell.x() - 0.5;
+        auto gy = (p.y() - bounds.y.min) / cell.y() - 0.5;
+        auto gz = (p.z() - bounds.z.min) / cell.z() - 0.5;
+        int i = static_cast<int>(floor(gx)), j = static_cast<int>(floor(gy)), k = static_cast<int>(floor(gz));
+        auto fx = gx - i, fy = gy - j, fz = gz - k;
+        double result = 0;
+        for (int di = 0; di < 2; di++)
+            for (int dj = 0; dj < 2; dj++)
+                for (int dk = 0; dk < 2; dk++)
+                {
+                    auto w = (di ? fx : 1 - fx) * (dj ? fy : 1 - fy) * (dk ? fz : 1 - fz);
+                    result += w * clampedVoxel(i + di, j + dj, k + dk);
+                }
+        return result;
+    }
+    // largest value any point inside voxels [i0, i1] x [j0, j1] x [k0, k1] can interpolate to
+    double maxDensity(int i0, int j0, int k0, int i1, int j1, int k1) const
+    {
+        double result = 0;
+        // interpolation reaches one voxel further on each side
+        for (int k = std::max(k0 - 1, 0); k <= std::min(k1 + 1, nz - 1); k++)
+            for (int j = std::max(j0 - 1, 0); j <= std::min(j1 + 1, ny - 1); j++)
+                for (int i = std::max(i0 - 1, 0); i <= std::min(i1 + 1, nx - 1); i++)
+                    result = fmax(result, voxel(i, j, k));
+        return result;
+    }
+
+    AABB bounds;
+    int nx, ny, nz;
+    vec3 cell;
+
+private:
+    double clampedVoxel(int i, int j, int k) const
+    {
+        // edges repeat the border voxel, past that the medium ends at bounds anyway
+        return voxel(std::clamp(i, 0, nx - 1), std::clamp(j, 0, ny - 1), std::clamp(k, 0, nz - 1));
+    }
+};
+
+// grid split into 8x8x8 bricks, only bricks with something in them take memory.
+// clouds and smoke are mostly empty space, so this holds much larger grids than one value per voxel would
+class SparseBrickGrid : public VoxelGrid
+{
+public:
+    static const int brick_size = 8;
+
+    SparseBrickGrid(const AABB &_bounds, int _nx, int _ny, int _nz) : VoxelGrid(_bounds, _nx, _ny, _nz)
+    {
+        bx = (nx + brick_size - 1) / brick_size;
+        by = (ny + brick_size - 1) / brick_size;
+        bz = (nz + brick_size - 1) / brick_size;
+        bricks.resize(static_cast<size_t>(bx) * by * bz);
+    }
+    double voxel(int i, int j, int k) const override
+    {
+        const auto &brick = bricks[brickIndex(i, j, k)];
+        return brick.empty() ? 0.0 : brick[inBrick(i, j, k)];
+    }
+    void setVoxel(int i, int j, int k, double value) override
+    {
+        auto &brick = bricks[brickIndex(i, j, k)];
+        if (brick.empty())
+        {
+            if (value == 0)
+            {
+                return;
+            }
+            brick.assign(brick_size * brick_size * brick_size, 0.0f);
+        }
+        brick[inBrick(i, j, k)] = static_cast<float>(value);
+    }
+    size_t allocatedBricks() const
+    {
+        return std::count_if(bricks.begin(), bricks.end(), [](const std::vector<float> &b)
+                             { return !b.empty(); });
+    }
+
+private:
+    int bx, by, bz;
+    std::vector<std::vector<float>> bricks;
+
+    size_t brickIndex(int i, int j, int k) const
+    {
+        return (static_cast<size_t>(k / brick_size) * by + j / brick_size) * bx + i / brick_size;
+    }
+    static int inBrick(int i, int j, int k)
+    {
+        return ((k % brick_size) * brick_size + j % brick_size) * brick_size + i % brick_size;
+    }
+};
+
+// Volume with density varying over a VoxelGrid, bounded by the grid's box.
+// free flight distances are sampled with delta tracking against a majorant (an upper bound of the density).
+// the majorant comes from a coarse grid walked with 3D DDA, so each stretch of the ray uses a tight local bound
+// and cells with nothing in them are stepped over without sampling anything
+class HeterogeneousMedium : public Hittable
+{
+public:
+    HeterogeneousMedium(std::shared_ptr<VoxelGrid> _grid, Color c, int majorant_cell = 8)
+        : grid(_grid), phase_function(std::make_shared<Isotropic>(c))
+    {
+        mx = (grid->nx + majorant_cell - 1) / majorant_cell;
+        my = (grid->ny + majorant_cell - 1) / majorant_cell;
+        mz = (grid->nz + majorant_cell - 1) / majorant_cell;
+        majorant_size = vec3(grid->bounds.x.size() / mx, grid->bounds.y.size() / my, grid->bounds.z.size() / mz);
+        majorants.resize(static_cast<size_t>(mx) * my * mz);
+        for (int k = 0; k < mz; k++)
+            for (int j = 0; j < my; j++)
+                for (int i = 0; i < mx; i++)
+                {
+                    // voxels whose centers can fall in this cell, padded by one
+                    auto lo = [&](int c, int n, int total)
+                    { return std::max(c * total / n - 1, 0); };
+                    auto hi = [&](int c, int n, int total)
+                    { return std::min((c + 1) * total / n, total - 1); };
+                    majorants[(static_cast<size_t>(k) * my + j) * mx + i] =
+                        grid->maxDensity(lo(i, mx, grid->nx), lo(j, my, grid->ny), lo(k, mz, grid->nz),
+                                         hi(i, mx, grid->nx), hi(j, my, grid->ny), hi(k, mz, grid->nz));
+                }
+    }
+
+    AABB boundingBox() const override { return grid->bounds; }
+    void visitMaterials(const std::function<void(const std::shared_ptr<Material> &)> &visit) const override
+    {
+        visit(phase_function);
+    }
+
+    bool hit(const Ray &ray, Interval t_limits, hit_info &info) const override
+    {
+        RT_STAT(STAT_MEDIUM_TESTS);
+        double t_hit = 0;
+        bool scattered = false;
+        march(ray, t_limits, [&](double t, double density, double majorant)
+              {
+                  // delta tracking, a tentative collision is real with probability density / majorant
+                  if (randomDouble() * majorant < density)
+                  {
+                      t_hit = t;
+                      scattered = true;
+                      return false;
+                  }
+                  return true; });
+        if (!scattered)
+        {
+            return false;
+        }
+        info.t = t_hit;
+        info.p = ray.at(t_hit);
+        info.normal = vec3(1, 1, 1); // arbitrary
+        info.front_face = true;      // arbitrary
+        info.u = 0;
+        info.v = 0;
+        info.mat = phase_function.get();
+        info.object = this;
+        return true;
+    }
+
+    // fraction of light that makes it through the medium along ray within t_limits, estimated with ratio tracking.
+    // unlike hit this never stops early on a collision, so shadow rays through the medium get a fraction rather than
+    // all or nothing
+    double transmittance(const Ray &ray, Interval t_limits) const override
+    {
+        double result = 1;
+        march(ray, t_limits, [&](double t, double density, double majorant)
+              {
+                  result *= 1 - density / majorant;
+                  return result > 1e-4; });
+        return result;
+    }
+
+private:
+    std::shared_ptr<VoxelGrid> grid;
+    std::shared_ptr<Material> phase_function;
+    int mx, my, mz;
+    vec3 majorant_size;
+    std::vector<double> majorants;
+
+    // walks the majorant grid cells the ray crosses, sampling tentative collisions with each cell's majorant.
+    // collide(t, density, majorant) is called for each and returns whether to keep going
+    template <typename Collide>
+    void march(const Ray &ray, Interval t_limits, Collide collide) const
+    {
+        // entry and exit computed once, straight from the box
+        Interval span;
+        if (!slabSpan(ray, span))
+        {
+            return;
+        }
+        span.min = fmax(span.min, fmax(t_limits.min, 0.0));
+        span.max = fmin(span.max, t_limits.max);
+        if (span.min >= span.max)
+        {
+            return;
+        }
+
+        auto ray_length = ray.direction().length();
+        const AABB &b = grid->bounds;
+        auto entry = ray.at(span.min);
+        int cell[3], step[3], limit[3] = {mx, my, mz};
+        double t_next[3], t_delta[3];
+        for (int a = 0; a < 3; a++)
+        {
+            auto lo = b.getAxis(a).min;
+            auto size = majorant_size[a];
+            cell[a] = std::clamp(static_cast<int>((entry[a] - lo) / size), 0, limit[a] - 1);
+            auto d = ray.direction()[a];
+            if (d > 0)
+            {
+                step[a] = 1;
+                t_next[a] = (lo + (cell[a] + 1) * size - ray.origin()[a]) / d;
+                t_delta[a] = size / d;
+            }
+            else if (d < 0)
+            {
+                step[a] = -1;
+                t_next[a] = (lo + cell[a] * size - ray.origin()[a]) / d;
+                t_delta[a] = -size / d;
+            }
+            else
+            {
+                step[a] = 0;
+                t_next[a] = infinity;
+                t_delta[a] = infinity;
+            }
+        }
+
+        double t = span.min;
+        while (t < span.max)
+        {
+            int axis = (t_next[0] < t_next[1]) ? (t_next[0] < t_next[2] ? 0 : 2) : (t_next[1] < t_next[2] ? 1 : 2);
+            auto cell_end = fmin(t_next[axis], span.max);
+            auto majorant = majorants[(static_cast<size_t>(cell[2]) * my + cell[1]) * mx + cell[0]];
+            if (majorant > 0)
+            {
+                // majorant per unit of t rather than per unit length
+                auto majorant_t = majorant * ray_length;
+                while (true)
+                {
+                    t -= rtLog(1 - randomDouble()) / majorant_t;
+                    if (t >= cell_end)
+                    {
+                        break;
+                    }
+                    if (!collide(t, grid->density(ray.at(t)), majorant))
+                    {
+                        return;
+                    }
+                }
+            }
+            // exponential distances are memoryless, so restarting at the cell boundary is exact
+            t = cell_end;
+            cell[axis] += step[axis];
+            if (cell[axis] < 0 || cell[axis] >= limit[axis])
+            {
+                return;
+            }
+            t_next[axis] += t_delta[axis];
+        }
+    }
+
+    bool slabSpan(const Ray &ray, Interval &span) const
+    {
+        span = Interval(-infinity, infinity);
+        for (int a = 0; a < 3; a++)
+        {
+            auto inv = 1 / ray.direction()[a];
+            auto t0 = (grid->bounds.getAxis(a).min - ray.origin()[a]) * inv;
+            auto t1 = (grid->bounds.getAxis(a).max - ray.origin()[a]) * inv;
+            if (inv < 0)
+            {
+                std::swap(t0, t1);
+            }
+            span.min = fmax(span.min, t0);
+            span.max = fmin(span.max, t1);
+        }
+        return span.min < span.max;
+    }
+};
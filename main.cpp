@@ -1,316 +1,207 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 #include "volume.h"
+#include "perlin.h"
 #include "camera.h"
 #include "texture.h"
 #include "sphere.h"
 #include "bvh_node.h"
 #include "quad.h"
 #include "hittable_array.h"
-
-void finalBookOneScene()
+#include "scene.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "environment.h"
+#include "render_server.h"
+
+// renders a short frame sequence of the book 1 field with a few bouncing spheres.
+// the bvh is built once and refit every frame, with degraded subtrees rebuilt, frames go to prefix_NNN.ppm
+void animateBookOneScene(int frames, const std::string &prefix)
 {
-    HittableArray world;
-
-    // materials and geometries are decoupled, have fun here
-    // this sets up the final render in book1, change according to your scene
+    HittableArray objects;
     auto checker = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
-
+    objects.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(checker)));
     for (int a = -11; a < 11; a++)
     {
         for (int b = -11; b < 11; b++)
         {
-            auto choose_mat = randomDouble();
             Point3 center(a + 0.9 * randomDouble(), 0.2, b + 0.9 * randomDouble());
-
-            if ((center - Point3(4, 0.2, 0)).length() > 0.9)
-            {
-                std::shared_ptr<Material> sphere_material;
-
-                if (choose_mat < 0.8)
-                {
-                    // diffuse
-                    auto albedo = Color::random() * Color::random();
-                    sphere_material = std::make_shared<Lambertian>(albedo);
-                    Point3 center_end = center + vec3(0, randomDouble(0, 0.5), 0);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95)
-                {
-                    // metal
-                    auto albedo = Color::random(0.5, 1);
-                    auto fuzz = randomDouble(0, 0.5);
-                    sphere_material = std::make_shared<Metal>(albedo, fuzz);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
-                else
-                {
-                    // glass
-                    sphere_material = std::make_shared<Dielectric>(1.5);
-                    world.add(std::make_shared<Sphere>(center, 0.2, sphere_material));
-                }
-            }
+            objects.add(std::make_shared<Sphere>(center, 0.2, std::make_shared<Lambertian>(Color::random() * Color::random())));
         }
     }
+    // the few objects that actually move between frames
+    std::vector<std::shared_ptr<Sphere>> bouncers;
+    std::vector<Point3> rest_positions;
+    for (int i = 0; i < 8; i++)
+    {
+        Point3 rest(randomDouble(-8, 8), 0.5, randomDouble(-8, 8));
+        auto sphere = std::make_shared<Sphere>(rest, 0.5, std::make_shared<Metal>(Color::random(0.5, 1), 0.1));
+        bouncers.push_back(sphere);
+        rest_positions.push_back(rest);
+        objects.add(sphere);
+    }
+    // and one that sweeps across the whole field, which is what eventually forces rebuilds
+    auto sweeper = std::make_shared<Sphere>(Point3(0, 3, -10), 1.0, std::make_shared<Dielectric>(1.5));
+    objects.add(sweeper);
 
-    auto material1 = std::make_shared<Dielectric>(1.5);
-    world.add(std::make_shared<Sphere>(Point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = std::make_shared<Lambertian>(Color(0.4, 0.2, 0.1));
-    world.add(std::make_shared<Sphere>(Point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = std::make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    world.add(std::make_shared<Sphere>(Point3(4, 1, 0), 1.0, material3));
-
-    world = HittableArray(std::make_shared<BVHNode>(world));
-
-    double aspect_ratio;   // imagewidth / imageheight
-    int img_width;         // Rendered image width in pixel count
-    int samples_per_pixel; // Count of random samples for each pixel, keep low for lower quality render
-    int max_depth;         // Maximum number of ray bounces into scene, keep low for low performance hardware and faster render time, can segfault
-    double vfov;           // Vertical view angle (field of view)
-    Point3 lookFrom;       // Point camera is looking from
-    Point3 lookAt;         // Point camera is looking at
-    vec3 vup;              // Camera-relative "up" direction
-    double defocus_angle;  // Variation angle of rays through each pixel
-    double focus_distance; // Distance from camera lookfrom point to plane of perfect focus
-
-    // Use this constructor after filling above values accordingly for different renders and comment out default
-    // Camera camera = Camera(aspect_ratio, img_width, samples_per_pixel, max_depth, vfov, lookFrom, lookAt, vup, defocus_angle, focus_distance)
-
-    // or use the default render
-    // Camera camera = Camera();
-
-    // for final render
-    Camera camera = Camera(16.0 / 9.0, 400, 400, 100, 20.0, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0.6, 10.0, Color(0.7, 0.8, 1.0));
-    camera.render(world);
-}
-
-void twoSpheres()
-{
-    HittableArray world;
-
-    auto checker = std::make_shared<CheckerTexture>(0.8, Color(.2, .3, .1), Color(.9, .9, .9));
-
-    world.add(std::make_shared<Sphere>(Point3(0, -10, 0), 10, std::make_shared<Lambertian>(checker)));
-    world.add(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker)));
-
-    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
-    camera.render(world);
-}
-void earth()
-{
-    auto earth_texture = std::make_shared<ImageTexture>("earthmap.jpg");
-    auto earth_surface = std::make_shared<Lambertian>(earth_texture);
-    auto globe = std::make_shared<Sphere>(Point3(0, 0, 0), 2, earth_surface);
-    auto world = HittableArray(globe);
-
-    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(0, 0, 12), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
-    camera.render(world);
-}
-
-void perlinSphere()
-{
-    HittableArray world;
-
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
-    camera.render(world);
-}
-void quads()
-{
-    HittableArray world;
-
-    // Materials
-    auto left_red = std::make_shared<Lambertian>(Color(1.0, 0.2, 0.2));
-    auto back_green = std::make_shared<Lambertian>(Color(0.2, 1.0, 0.2));
-    auto right_blue = std::make_shared<Lambertian>(Color(0.2, 0.2, 1.0));
-    auto upper_orange = std::make_shared<Lambertian>(Color(1.0, 0.5, 0.0));
-    auto lower_teal = std::make_shared<Lambertian>(Color(0.2, 0.8, 0.8));
-
-    // Quads
-    world.add(std::make_shared<Quad>(Point3(-3, -2, 5), vec3(0, 0, -4), vec3(0, 4, 0), left_red));
-    world.add(std::make_shared<Quad>(Point3(-2, -2, 0), vec3(4, 0, 0), vec3(0, 4, 0), back_green));
-    world.add(std::make_shared<Quad>(Point3(3, -2, 1), vec3(0, 0, 4), vec3(0, 4, 0), right_blue));
-    world.add(std::make_shared<Quad>(Point3(-2, 3, 1), vec3(4, 0, 0), vec3(0, 0, 4), upper_orange));
-    world.add(std::make_shared<Quad>(Point3(-2, -3, 5), vec3(4, 0, 0), vec3(0, 0, -4), lower_teal));
-
-    Camera camera(1.0, 400, 100, 50, 80, Point3(0, 0, 9), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10, Color(0.7, 0.8, 1.0));
-    camera.render(world);
-}
-void simpleLight()
-{
-    HittableArray world;
-
-    auto pertext = std::make_shared<NoiseTexture>(4);
-    world.add(std::make_shared<Sphere>(Point3(0, -1000, 0), 1000, std::make_shared<Lambertian>(pertext)));
-    world.add(std::make_shared<Sphere>(Point3(0, 2, 0), 2, std::make_shared<Lambertian>(pertext)));
-
-    auto difflight = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(4, 4, 4)));
-    world.add(std::make_shared<Sphere>(Point3(0, 7, 0), 2, difflight));
-    world.add(std::make_shared<Quad>(Point3(3, 1, -2), vec3(2, 0, 0), vec3(0, 2, 0), difflight));
+    auto bvh = std::make_shared<BVHNode>(objects);
+    auto world = HittableArray(bvh);
+    Camera camera(16.0 / 9.0, 400, 50, 50, 20.0, Point3(13, 2, 3), Point3(0, 0, 0), vec3(0, 1, 0), 0, 10.0, Color(0.7, 0.8, 1.0));
 
-    Camera camera(16.0 / 9.0, 400, 100, 50, 20, Point3(26, 3, 6), Point3(0, 2, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
-    camera.render(world);
+    const double rebuild_threshold = 1.5;
+    for (int frame = 0; frame < frames; frame++)
+    {
+        double phase = static_cast<double>(frame) / frames;
+        for (size_t i = 0; i < bouncers.size(); i++)
+        {
+            auto height = 2 * fabs(sin(2 * pi * phase + i));
+            bouncers[i]->moveTo(rest_positions[i] + vec3(0, height, 0));
+        }
+        sweeper->moveTo(Point3(0, 3, -10 + 20 * phase));
+
+        auto start = std::chrono::steady_clock::now();
+        bvh->refit();
+        int rebuilt = bvh->rebuildDegraded(rebuild_threshold);
+        auto refit_done = std::chrono::steady_clock::now();
+        // only for the report, what a fresh tree would have cost
+        BVHNode full_rebuild(objects);
+        auto rebuild_done = std::chrono::steady_clock::now();
+
+        std::clog << "\rframe " << frame << " : refit + partial rebuild " << std::chrono::duration<double, std::milli>(refit_done - start).count()
+                  << " ms (" << rebuilt << " subtrees rebuilt, sah " << bvh->sahCost() << "), full rebuild "
+                  << std::chrono::duration<double, std::milli>(rebuild_done - refit_done).count()
+                  << " ms (sah " << full_rebuild.sahCost() << ")\n";
+
+        char number[16];
+        snprintf(number, sizeof(number), "_%03d.ppm", frame);
+        std::ofstream out(prefix + number);
+        if (!out)
+        {
+            std::clog << "Could not write " << prefix + number << '\n';
+            return;
+        }
+        camera.render(world, out);
+    }
 }
-void cornellBox()
-{
-    HittableArray world;
 
-    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(15, 15, 15)));
-
-    world.add(std::make_shared<Quad>(Point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(std::make_shared<Quad>(Point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(std::make_shared<Quad>(Point3(555, 555, 555), vec3(-555, 0, 0), vec3(0, 0, -555), white));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(15, box1);
-    box1 = std::make_shared<Translate>(box1, vec3(265, 0, 295));
-    world.add(box1);
-
-    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(-18, box2);
-    box2 = std::make_shared<Translate>(box2, vec3(130, 0, 65));
-    world.add(box2);
-
-    Camera camera(1.0, 600, 100, 50, 40, Point3(278, 278, -800), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
-    camera.render(world);
-}
-void cornellSmoke()
+// loads a fixed scene from its binary cache, building and caching it on the first run.
+// the scene builders (scenes.h) are compiled into this file, so a cache from any other build of it may be stale and
+// is rebuilt
+Scene cachedScene(const std::string &path, Scene (*build)())
 {
-    HittableArray world;
-
-    auto red = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(7, 7, 7)));
-
-    world.add(std::make_shared<Quad>(Point3(555, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), green));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(0, 555, 0), vec3(0, 0, 555), red));
-    world.add(std::make_shared<Quad>(Point3(113, 554, 127), vec3(330, 0, 0), vec3(0, 0, 305), light));
-    world.add(std::make_shared<Quad>(Point3(0, 555, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 0), vec3(555, 0, 0), vec3(0, 0, 555), white));
-    world.add(std::make_shared<Quad>(Point3(0, 0, 555), vec3(555, 0, 0), vec3(0, 555, 0), white));
-
-    std::shared_ptr<Hittable> box1 = box(Point3(0, 0, 0), Point3(165, 330, 165), white);
-    box1 = std::make_shared<RotateY>(15, box1);
-    box1 = std::make_shared<Translate>(box1, vec3(265, 0, 295));
-
-    std::shared_ptr<Hittable> box2 = box(Point3(0, 0, 0), Point3(165, 165, 165), white);
-    box2 = std::make_shared<RotateY>(-18, box2);
-    box2 = std::make_shared<Translate>(box2, vec3(130, 0, 65));
-
-    world.add(std::make_shared<ConstantMedium>(box1, 0.01, Color(0, 0, 0)));
-    world.add(std::make_shared<ConstantMedium>(box2, 0.01, Color(1, 1, 1)));
-
-    Camera camera(1.0, 600, 200, 50, 40, Point3(28, 278, -800), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
-    camera.render(world);
+    static const auto fingerprint = sceneFingerprint(__DATE__ " " __TIME__);
+    auto mapped = std::make_shared<MappedScene>(path, fingerprint);
+    if (mapped->valid())
+    {
+        std::clog << "Loaded scene cache " << path << '\n';
+        return Scene{mapped, mapped->camera()};
+    }
+    Scene scene = build();
+    if (!SceneCacheWriter().write(path, *scene.world, scene.camera, fingerprint))
+    {
+        std::clog << "Could not cache scene to " << path << '\n';
+    }
+    return scene;
 }
-void finalBookTwoScene()
+int main(int argc, char **argv)
 {
-    HittableArray boxes1;
-    auto ground = std::make_shared<Lambertian>(Color(0.48, 0.83, 0.53));
-
-    int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++)
+    if (argc > 2 && std::string(argv[1]) == "--animate")
     {
-        for (int j = 0; j < boxes_per_side; j++)
+        // --animate <frames> [prefix], frames go to prefix_000.ppm onwards, frame_000.ppm without one
+        animateBookOneScene(std::atoi(argv[2]), argc > 3 ? argv[3] : "frame");
+        return 0;
+    }
+    if (argc > 2 && std::string(argv[1]) == "--serve")
+    {
+        // --serve <socket path> [threads] keeps scenes loaded between jobs, see render_server.h
+        RenderServer server;
+        for (const auto &entry : builtinScenes())
         {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i * w;
-            auto z0 = -1000.0 + j * w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = randomDouble(1, 101);
-            auto z1 = z0 + w;
-
-            boxes1.add(box(Point3(x0, y0, z0), Point3(x1, y1, z1), ground));
+            server.addScene(entry.name, entry.build);
         }
+        // book1 through the binary cache, like below
+        server.addScene("book1", []()
+                        { return cachedScene("book1.rtscene", finalBookOneScene); });
+        return server.serve(argv[2], argc > 3 ? std::atoi(argv[3]) : threadCount()) ? 0 : 1;
     }
-
-    HittableArray world;
-
-    world.add(std::make_shared<BVHNode>(boxes1));
-
-    auto light = std::make_shared<DiffuseLight>(std::make_shared<SolidColor>(Color(7, 7, 7)));
-    world.add(std::make_shared<Quad>(Point3(123, 554, 147), vec3(300, 0, 0), vec3(0, 0, 265), light));
-
-    auto center1 = Point3(400, 400, 200);
-    auto center2 = center1 + vec3(30, 0, 0);
-    auto sphere_material = std::make_shared<Lambertian>(Color(0.7, 0.3, 0.1));
-    world.add(std::make_shared<Sphere>(center1, center2, 50, sphere_material));
-
-    world.add(std::make_shared<Sphere>(Point3(260, 150, 45), 50, std::make_shared<Dielectric>(1.5)));
-    world.add(std::make_shared<Sphere>(
-        Point3(0, 150, 145), 50, std::make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)));
-
-    auto boundary = std::make_shared<Sphere>(Point3(360, 150, 145), 70, std::make_shared<Dielectric>(1.5));
-    world.add(boundary);
-    world.add(std::make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-    boundary = std::make_shared<Sphere>(Point3(0, 0, 0), 5000, std::make_shared<Dielectric>(1.5));
-    world.add(std::make_shared<ConstantMedium>(boundary, .0001, Color(1, 1, 1)));
-
-    auto emat = std::make_shared<Lambertian>(std::make_shared<ImageTexture>("earthmap.jpg"));
-    world.add(std::make_shared<Sphere>(Point3(400, 200, 400), 100, emat));
-    auto pertext = std::make_shared<NoiseTexture>(0.1);
-    world.add(std::make_shared<Sphere>(Point3(220, 280, 300), 80, std::make_shared<Lambertian>(pertext)));
-
-    HittableArray boxes2;
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    int ns = 100;
-    for (int j = 0; j < ns; j++)
+    // --scene <number> picks one of builtinScenes() (scenes.h), counted from 1, --trace <path> writes a timeline of the
+    // run as Chrome trace json (trace.h), --perf 1 reports hardware performance counters per phase (perf_counters.h)
+    int which = 9;
+    std::string trace_path;
+    bool perf = false;
+    for (int k = 1; k + 1 < argc; k += 2)
     {
-        boxes2.add(std::make_shared<Sphere>(Point3::random(0, 165), 10, white));
+        if (std::string(argv[k]) == "--scene")
+            which = std::atoi(argv[k + 1]);
+        else if (std::string(argv[k]) == "--trace")
+            trace_path = argv[k + 1];
+        else if (std::string(argv[k]) == "--perf")
+            perf = std::atoi(argv[k + 1]) != 0;
     }
-
-    world.add(std::make_shared<Translate>(
-        std::make_shared<RotateY>(15,
-                                  std::make_shared<BVHNode>(boxes2)),
-        vec3(-100, 270, 395)));
-
-    Camera camera(1.0, 400, 100, 4, 40, Point3(478, 278, -600), Point3(278, 278, 0), vec3(0, 1, 0), 0, 10, Color(0, 0, 0));
-    camera.render(world);
-}
-int main()
-{
-    switch (9)
+    if (!trace_path.empty())
+    {
+        Tracer::instance().enable();
+    }
+    if (perf)
     {
-    case 1:
-        finalBookOneScene();
-        break;
-    case 2:
-        twoSpheres();
-        break;
-    case 3:
-        earth();
-        break;
-    case 4:
-        perlinSphere();
-        break;
-    case 5:
-        quads();
-        break;
-    case 6:
-        simpleLight();
-        break;
-    case 7:
-        cornellBox();
-        break;
-    case 8:
-        cornellSmoke();
-        break;
-    case 9:
-        finalBookTwoScene();
-        break;
+        PerfProfiler::instance().enable();
     }
-}
\ No newline at end of file
+    auto scene_count = static_cast<int>(builtinScenes().size());
+    which = which < 1 ? 1 : (which > scene_count ? scene_count : which);
+    Scene scene;
+    {
+        TraceScope scope("scene build");
+        PerfScope counters("build");
+        // book1 is a fixed scene, so it goes through the binary cache instead of being rebuilt every run
+        scene = which == 1 ? cachedScene("book1.rtscene", finalBookOneScene) : builtinScenes()[which - 1].build();
+        scene.camera.scene_name = builtinScenes()[which - 1].name;
+    }
+    // --progressive <spp per pass> renders in full frame passes, --checkpoint <path> resumes from and saves to path,
+    // --preview <path> writes the image so far to path every few seconds, --time-budget <seconds> stops when the time is up,
+    // --workers <count> renders tiles in that many worker processes, --stats <path> writes the render statistics as
+    // json (when compiled in, see stats.h), --heatmaps <prefix> writes per pixel cost images, --width <pixels> overrides
+    // the scene's image width, --crop x0,y0,x1,y1 renders only those pixels, --stream <path> writes the image to path
+    // a tile at a time as a binary ppm, for images too big to hold in memory (tile_writer.h)
+    for (int k = 1; k + 1 < argc; k += 2)
+    {
+        std::string flag = argv[k];
+        if (flag == "--progressive")
+            scene.camera.progressive_spp = std::atoi(argv[k + 1]);
+        else if (flag == "--checkpoint")
+            scene.camera.checkpoint_path = argv[k + 1];
+        else if (flag == "--preview")
+            scene.camera.preview_path = argv[k + 1];
+        else if (flag == "--time-budget")
+            scene.camera.time_budget = std::atof(argv[k + 1]);
+        else if (flag == "--workers")
+            scene.camera.workers = std::atoi(argv[k + 1]);
+        else if (flag == "--stats")
+            scene.camera.stats_path = argv[k + 1];
+        else if (flag == "--heatmaps")
+            scene.camera.heatmap_prefix = argv[k + 1];
+        else if (flag == "--width")
+            scene.camera.img_width = std::atoi(argv[k + 1]);
+        else if (flag == "--crop")
+        {
+            Tile &crop = scene.camera.crop;
+            std::sscanf(argv[k + 1], "%d,%d,%d,%d", &crop.x0, &crop.y0, &crop.x1, &crop.y1);
+        }
+        else if (flag == "--stream")
+            scene.camera.stream_path = argv[k + 1];
+    }
+    scene.camera.render(*scene.world);
+    if (perf)
+    {
+        PerfProfiler::instance().report(std::clog);
+    }
+    if (!trace_path.empty() && !Tracer::instance().write(trace_path))
+    {
+        std::clog << "Could not write trace " << trace_path << '\n';
+    }
+}